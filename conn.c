@@ -1,24 +1,75 @@
 /* Challenging Thursdays Connection Management */
+#include <errno.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include "conn.h"
 
 #define MAX(a, b)	((a) < (b) ? (b) : (a))
+#define CBUFSZ		(1 << 12)	/* size of output buffers */
+#define CBUFPOOL	256		/* maximum number of unused buffers kept */
+#define CBUFIOV		16		/* maximum buffers written at once */
+
+/* output buffer */
+struct cbuf {
+	struct cbuf *next;	/* next buffer in the chain */
+	long beg, end;		/* data[beg..end) is not sent yet */
+	int fd;			/* if not -1, send fd[beg..end) instead */
+	char data[CBUFSZ];
+};
 
 struct conn {
 	int fd;			/* socket file descriptor */
 	void *ibuf;		/* input buffer */
+	long ibuf_beg;		/* the first byte of ibuf not consumed */
 	long ibuf_n;		/* received bytes in ibuf */
 	long ibuf_sz;		/* size of ibuf[] */
-	void *obuf;		/* output buffers */
+	struct cbuf *obuf;	/* the chain of output buffers */
+	struct cbuf *olast;	/* the last buffer in obuf chain */
 	long obuf_n;		/* number of bytes in obuf */
-	long obuf_sz;		/* size of obuf[] */
 	int dosend, dorecv;	/* fd can be read from or written to */
 };
 
+static struct cbuf *cbuf_pool;	/* unused output buffers */
+static int cbuf_pool_n;		/* number of buffers in cbuf_pool */
+static long conn_nsent;		/* total bytes sent */
+static long conn_nrecv;		/* total bytes received */
+
+static struct cbuf *cbuf_get(void)
+{
+	struct cbuf *cb = cbuf_pool;
+	if (cb) {
+		cbuf_pool = cb->next;
+		cbuf_pool_n--;
+	} else if (!(cb = malloc(sizeof(*cb)))) {
+		return NULL;
+	}
+	cb->next = NULL;
+	cb->beg = 0;
+	cb->end = 0;
+	cb->fd = -1;
+	return cb;
+}
+
+static void cbuf_put(struct cbuf *cb)
+{
+	if (cb->fd >= 0)
+		close(cb->fd);
+	if (cbuf_pool_n >= CBUFPOOL) {
+		free(cb);
+		return;
+	}
+	cb->next = cbuf_pool;
+	cbuf_pool = cb;
+	cbuf_pool_n++;
+}
+
 struct conn *conn_make(int fd)
 {
 	struct conn *conn = malloc(sizeof(*conn));
@@ -38,9 +89,13 @@ void conn_hang(struct conn *conn)
 
 void conn_free(struct conn *conn)
 {
+	struct cbuf *cb;
 	conn_hang(conn);
+	while ((cb = conn->obuf)) {
+		conn->obuf = cb->next;
+		cbuf_put(cb);
+	}
 	free(conn->ibuf);
-	free(conn->obuf);
 	free(conn);
 }
 
@@ -56,38 +111,95 @@ int conn_events(struct conn *conn)
 static int mextend(void **ptr, long *sz, long memsz)
 {
 	long newsz = MAX(128, *sz * 2);
-	void *new = malloc(newsz * memsz);
+	void *new = realloc(*ptr, newsz * memsz);
 	if (!new)
 		return 1;
-	memcpy(new, *ptr, *sz * memsz);
-	memset(new + *sz * memsz, 0, (newsz - *sz) * memsz);
-	free(*ptr);
 	*ptr = new;
 	*sz = newsz;
 	return 0;
 }
 
+/* make room for reading into ibuf */
+static int conn_room(struct conn *conn)
+{
+	if (conn->ibuf_n < conn->ibuf_sz)
+		return 0;
+	if (conn->ibuf_beg > 0) {	/* move unconsumed bytes to the start */
+		memmove(conn->ibuf, conn->ibuf + conn->ibuf_beg,
+			conn->ibuf_n - conn->ibuf_beg);
+		conn->ibuf_n -= conn->ibuf_beg;
+		conn->ibuf_beg = 0;
+		if (conn->ibuf_n < conn->ibuf_sz)
+			return 0;
+	}
+	return mextend(&(conn->ibuf), &(conn->ibuf_sz), 1);
+}
+
+/* write the output buffers with writev() or sendfile(); return zero on EOF */
+static int conn_write(struct conn *conn)
+{
+	struct iovec iov[CBUFIOV];
+	struct cbuf *cb = conn->obuf;
+	int n = 0;
+	long nw;
+	if (cb->fd >= 0) {
+		off_t off = cb->beg;
+		nw = sendfile(conn->fd, cb->fd, &off, cb->end - cb->beg);
+		if (nw > 0)
+			conn_nsent += nw;
+		if (nw == 0)		/* the file is truncated */
+			nw = cb->end - cb->beg;
+	} else {
+		for (; cb && cb->fd < 0 && n < CBUFIOV; cb = cb->next) {
+			iov[n].iov_base = cb->data + cb->beg;
+			iov[n].iov_len = cb->end - cb->beg;
+			n++;
+		}
+		nw = writev(conn->fd, iov, n);
+		if (nw > 0)
+			conn_nsent += nw;
+	}
+	if (nw <= 0)
+		return nw;
+	conn->obuf_n -= nw;
+	while (nw > 0) {
+		cb = conn->obuf;
+		if (cb->end - cb->beg > nw) {
+			cb->beg += nw;
+			break;
+		}
+		nw -= cb->end - cb->beg;
+		conn->obuf = cb->next;
+		if (!conn->obuf)
+			conn->olast = NULL;
+		cbuf_put(cb);
+	}
+	return 1;
+}
+
+/* read or write as much as possible, as required for edge-triggered events */
 int conn_poll(struct conn *conn, int events)
 {
-	int nr, nw;
+	int nr = -1, nw = -1;
 	if (events & POLLRDNORM) {
-		if (conn->ibuf_n == conn->ibuf_sz)
-			if (mextend(&(conn->ibuf), &(conn->ibuf_sz), 1))
+		do {
+			if (conn_room(conn))
 				return 1;
-		nr = read(conn->fd, conn->ibuf + conn->ibuf_n,
-				conn->ibuf_sz - conn->ibuf_n);
-		if (nr > 0)
-			conn->ibuf_n += nr;
+			nr = read(conn->fd, conn->ibuf + conn->ibuf_n,
+					conn->ibuf_sz - conn->ibuf_n);
+			if (nr > 0) {
+				conn->ibuf_n += nr;
+				conn_nrecv += nr;
+			}
+		} while (nr > 0 || (nr < 0 && errno == EINTR));
 		if (nr == 0)		/* socket is half duplex */
 			conn->dorecv = 0;
 	}
 	if (events & POLLWRNORM) {
-		nw = write(conn->fd, conn->obuf, conn->obuf_n);
-		if (nw > 0) {
-			if (nw < conn->obuf_n)
-				memmove(conn->obuf, conn->obuf + nw,
-					conn->obuf_n - nw);
-			conn->obuf_n -= nw;
+		while (conn->obuf_n > 0) {
+			nw = conn_write(conn);
+			if (nw <= 0 && !(nw < 0 && errno == EINTR))
+				break;
 		}
 		if (nw == 0)
 			conn->dosend = 0;
@@ -99,16 +211,63 @@ int conn_poll(struct conn *conn, int events)
 	return 0;
 }
 
-int conn_send(struct conn *conn, void *buf, long len)
+/* append a buffer to the output chain */
+static void conn_append(struct conn *conn, struct cbuf *cb)
 {
-	while (conn->obuf_n + len >= conn->obuf_sz)
-		if (mextend(&(conn->obuf), &(conn->obuf_sz), 1))
-			return 1;
-	memcpy(conn->obuf + conn->obuf_n, buf, len);
+	if (conn->olast)
+		conn->olast->next = cb;
+	else
+		conn->obuf = cb;
+	conn->olast = cb;
+}
+
+/* send the first len bytes of fd with sendfile(); fd is closed afterwards */
+int conn_sendfile(struct conn *conn, int fd, long len)
+{
+	struct cbuf *cb = len > 0 ? cbuf_get() : NULL;
+	if (!cb) {
+		close(fd);
+		return len > 0;
+	}
+	cb->fd = fd;
+	cb->end = len;
 	conn->obuf_n += len;
+	conn_append(conn, cb);
+	return 0;
+}
+
+int conn_send(struct conn *conn, void *buf, long len)
+{
+	while (len > 0) {
+		struct cbuf *cb = conn->olast;
+		long n;
+		if (!cb || cb->fd >= 0 || cb->end == CBUFSZ) {
+			if (!(cb = cbuf_get()))
+				return 1;
+			conn_append(conn, cb);
+		}
+		n = MAX(0, CBUFSZ - cb->end);
+		if (n > len)
+			n = len;
+		memcpy(cb->data + cb->end, buf, n);
+		cb->end += n;
+		conn->obuf_n += n;
+		buf += n;
+		len -= n;
+	}
 	return 0;
 }
 
+void conn_printf(struct conn *conn, char *fmt, ...)
+{
+	va_list ap;
+	char buf[512];
+	va_start(ap, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	conn_send(conn, buf, strlen(buf));
+}
+
 int conn_hung(struct conn *conn)
 {
 	return conn->fd < 0 || (!conn->dosend && !conn->dorecv);
@@ -116,33 +275,27 @@ int conn_hung(struct conn *conn)
 
 long conn_len(struct conn *conn)
 {
-	return conn->ibuf_n;
+	return conn->ibuf_n - conn->ibuf_beg;
 }
 
 int conn_recv(struct conn *conn, void *buf, long len)
 {
-	if (conn->ibuf_n < len)
-		len = conn->ibuf_n;
-	memcpy(buf, conn->ibuf, len);
-	memmove(conn->ibuf, conn->ibuf + len, conn->ibuf_n - len);
-	conn->ibuf_n -= len;
+	if (conn_len(conn) < len)
+		len = conn_len(conn);
+	if (buf)
+		memcpy(buf, conn->ibuf + conn->ibuf_beg, len);
+	conn->ibuf_beg += len;
+	if (conn->ibuf_beg == conn->ibuf_n) {
+		conn->ibuf_beg = 0;
+		conn->ibuf_n = 0;
+	}
 	return len;
 }
 
-int conn_recvall(struct conn *conn, void **buf, long *len)
-{
-	*buf = conn->ibuf;
-	*len = conn->ibuf_n;
-	conn->ibuf = NULL;
-	conn->ibuf_n = 0;
-	conn->ibuf_sz = 0;
-	return 0;
-}
-
 int conn_recvbuf(struct conn *conn, void **buf, long *len)
 {
-	*buf = conn->ibuf;
-	*len = conn->ibuf_n;
+	*buf = conn->ibuf ? conn->ibuf + conn->ibuf_beg : NULL;
+	*len = conn_len(conn);
 	return conn->ibuf == NULL;
 }
 
@@ -150,3 +303,10 @@ int conn_fd(struct conn *conn)
 {
 	return conn->fd;
 }
+
+/* total bytes sent and received by all connections */
+void conn_stats(long *sent, long *recvd)
+{
+	*sent = conn_nsent;
+	*recvd = conn_nrecv;
+}
@@ -0,0 +1,235 @@
+/* Challenging Thursdays Judge Benchmark */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LLEN		256		/* maximum path length */
+
+/* the solution: copy the input to the output */
+static char *solution =
+	"#include <unistd.h>\n"
+	"int main(void)\n"
+	"{\n"
+	"\tstatic char buf[1 << 16];\n"
+	"\tint nr;\n"
+	"\twhile ((nr = read(0, buf, sizeof(buf))) > 0)\n"
+	"\t\twrite(1, buf, nr);\n"
+	"\treturn 0;\n"
+	"}\n";
+
+/* the verifier: compare the input and the output */
+static char *verifier =
+	"#!/bin/sh\n"
+	"cmp -s .i .o && echo 1 || echo 0\n";
+
+/* synthetic contests */
+static struct bench {
+	char *name;			/* contest name */
+	int cases;			/* number of test cases */
+	long size;			/* input size of each test case */
+	int verify;			/* use verifier programs */
+	char *limits;			/* the limits file */
+} benches[] = {
+	{"tiny", 100, 16, 0, ""},
+	{"huge", 2, 64 << 20, 0, "fsize 131072\n"},
+	{"verifier", 20, 1 << 10, 1, ""},
+};
+
+static char *test = "./test";		/* judge program */
+static char *test_jobs = "1";		/* judge -j option */
+static int reps = 3;			/* runs of each benchmark */
+
+static long util_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int util_write(char *path, char *buf, long len, int mode)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, mode);
+	long nw = 0, n;
+	if (fd < 0)
+		return 1;
+	while (nw < len && (n = write(fd, buf + nw, len - nw)) > 0)
+		nw += n;
+	close(fd);
+	return nw < len;
+}
+
+/* create the test cases of a synthetic contest */
+static int bench_make(struct bench *b, char *dir)
+{
+	char path[LLEN * 2];
+	char *buf = malloc(b->size);
+	long i;
+	int c;
+	if (!buf)
+		return 1;
+	mkdir(dir, 0700);
+	snprintf(path, sizeof(path), "%s/limits", dir);
+	util_write(path, b->limits, strlen(b->limits), 0644);
+	for (c = 0; c < b->cases; c++) {
+		for (i = 0; i < b->size; i++)
+			buf[i] = i % 64 == 63 ? '\n' : 'a' + (c + i) % 26;
+		snprintf(path, sizeof(path), "%s/%02d", dir, c);
+		if (util_write(path, buf, b->size, 0644))
+			break;
+		snprintf(path, sizeof(path), b->verify ? "%s/%02dv" : "%s/%02do", dir, c);
+		if (b->verify && util_write(path, verifier, strlen(verifier), 0755))
+			break;
+		if (!b->verify && util_write(path, buf, b->size, 0644))
+			break;
+	}
+	free(buf);
+	return c < b->cases;
+}
+
+/* remove a synthetic contest */
+static void bench_clean(struct bench *b, char *dir)
+{
+	char path[LLEN * 2];
+	int c;
+	snprintf(path, sizeof(path), "%s/limits", dir);
+	unlink(path);
+	for (c = 0; c < b->cases; c++) {
+		snprintf(path, sizeof(path), "%s/%02d", dir, c);
+		unlink(path);
+		snprintf(path, sizeof(path), b->verify ? "%s/%02dv" : "%s/%02do", dir, c);
+		unlink(path);
+	}
+	rmdir(dir);
+}
+
+/* run the judge and read its -x output */
+static int bench_run(char *cont, char *prog, char *out, int len)
+{
+	char *argv[] = {test, "-x", "-j", test_jobs, cont, prog, "c", NULL};
+	int pfd[2];
+	int pid, nr, n = 0;
+	if (pipe(pfd))
+		return 1;
+	if (!(pid = fork())) {
+		dup2(pfd[1], 1);
+		close(pfd[0]);
+		close(pfd[1]);
+		execv(argv[0], argv);
+		_exit(1);		/* do not flush the parent's stdout */
+	}
+	close(pfd[1]);
+	while (n + 1 < len && (nr = read(pfd[0], out + n, len - n - 1)) > 0)
+		n += nr;
+	out[n] = '\0';
+	close(pfd[0]);
+	waitpid(pid, NULL, 0);
+	return pid < 0 || n == 0;
+}
+
+static int longcmp(const void *v1, const void *v2)
+{
+	long a = *(long *) v1, b = *(long *) v2;
+	return a < b ? -1 : a > b;
+}
+
+static void printusage(char *prog)
+{
+	printf("Usage: %s [options]\n\n", prog);
+	printf("Options:\n");
+	printf("  -t path \t judge program (%s)\n", test);
+	printf("  -d dir  \t directory for synthetic contests (temporary)\n");
+	printf("  -n n    \t runs of each benchmark (%d)\n", reps);
+	printf("  -j n    \t concurrent test cases in the judge (%s)\n", test_jobs);
+}
+
+int main(int argc, char *argv[])
+{
+	char tmpdir[LLEN] = "/tmp/ctbenchXXXXXX";
+	char *dir = NULL;
+	char prog[LLEN + 16], cont[LLEN + 16], out[1 << 12];
+	long wall[16], cc[16], sol[16], over[16];
+	int keep;			/* keep the contests in -d dir */
+	int i, j, r;
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (argv[i][1] == 't')
+			test = argv[i][2] ? argv[i] + 2 : argv[++i];
+		if (argv[i][1] == 'd')
+			dir = argv[i][2] ? argv[i] + 2 : argv[++i];
+		if (argv[i][1] == 'n')
+			reps = atoi(argv[i][2] ? argv[i] + 2 : argv[++i]);
+		if (argv[i][1] == 'j')
+			test_jobs = argv[i][2] ? argv[i] + 2 : argv[++i];
+		if (argv[i][1] == 'h') {
+			printusage(argv[0]);
+			return 0;
+		}
+	}
+	if (reps < 1 || reps > 16) {
+		printusage(argv[0]);
+		return 1;
+	}
+	keep = dir != NULL;
+	if (!dir && !(dir = mkdtemp(tmpdir))) {
+		fprintf(stderr, "ctbench: cannot create a temporary directory\n");
+		return 1;
+	}
+	mkdir(dir, 0755);
+	chmod(dir, 0755);		/* verifiers run as the sandbox user */
+	snprintf(prog, sizeof(prog), "%s/cat.c", dir);
+	if (util_write(prog, solution, strlen(solution), 0644)) {
+		fprintf(stderr, "ctbench: cannot write %s\n", prog);
+		if (!keep)
+			rmdir(dir);
+		return 1;
+	}
+	printf("bench\tcases\tscore\twall_ms\tcc_ms\tsol_ms\tover_ms\tover_us/case\n");
+	for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+		struct bench *b = &benches[i];
+		char score[64] = "-";
+		snprintf(cont, sizeof(cont), "%s/%s", dir, b->name);
+		if (bench_make(b, cont)) {
+			fprintf(stderr, "ctbench: cannot create %s\n", cont);
+			if (!keep)
+				bench_clean(b, cont);
+			continue;
+		}
+		for (r = 0; r < reps; r++) {
+			char *s;
+			long beg = util_ms();
+			if (bench_run(cont, prog, out, sizeof(out)))
+				break;
+			wall[r] = util_ms() - beg;
+			sscanf(out, "%63s", score);
+			s = strchr(out, '\n');
+			cc[r] = s ? atol(s + 1) : 0;
+			sol[r] = 0;
+			for (j = 0; s && (s = strchr(s + 1, '/')); j++)
+				if (j % 3 == 0)		/* verdict/ms/kb/sig */
+					sol[r] += atol(s + 1);
+			over[r] = wall[r] - cc[r] - sol[r];
+		}
+		if (!keep)
+			bench_clean(b, cont);
+		if (r < reps) {
+			fprintf(stderr, "ctbench: %s failed\n", test);
+			break;
+		}
+		qsort(wall, reps, sizeof(wall[0]), longcmp);
+		qsort(cc, reps, sizeof(cc[0]), longcmp);
+		qsort(sol, reps, sizeof(sol[0]), longcmp);
+		qsort(over, reps, sizeof(over[0]), longcmp);
+		printf("%s\t%d\t%s\t%ld\t%ld\t%ld\t%ld\t%ld\n", b->name, b->cases,
+			score, wall[reps / 2], cc[reps / 2], sol[reps / 2],
+			over[reps / 2], over[reps / 2] * 1000 / b->cases);
+	}
+	if (!keep) {
+		unlink(prog);
+		rmdir(dir);
+	}
+	return i < sizeof(benches) / sizeof(benches[0]);
+}
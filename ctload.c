@@ -0,0 +1,314 @@
+/* Challenging Thursdays Server Load Generator */
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LLEN		256		/* maximum request line length */
+#define MAXCONNS	4096		/* maximum concurrent connections */
+#define MAXREQS		(1 << 20)	/* maximum recorded requests */
+
+/* request kinds */
+#define REG		0
+#define REP		1
+#define SUB		2
+
+static char *kinds[] = {"register", "report", "submit"};
+
+struct cli {
+	int fd;				/* connection; -1 if idle */
+	int kind;			/* request kind */
+	char *req;			/* request */
+	long req_n;			/* request length */
+	long req_off;			/* bytes of req written */
+	long beg;			/* request start time */
+	long recvd;			/* bytes received */
+};
+
+static struct addrinfo *addr;		/* server address */
+static char *cont = "c1";		/* contest name */
+static char *prog;			/* submitted program */
+static long prog_n;			/* size of prog */
+static int users = 100;			/* number of submitting users */
+static int weights[3] = {1, 8, 1};	/* request mix */
+static long lat[3][MAXREQS];		/* request latencies in microseconds */
+static long lat_n[3];			/* number of requests of each kind */
+static long fails[3];			/* requests without a response */
+static long bytes;			/* total bytes received */
+
+static long util_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000l + ts.tv_nsec / 1000;
+}
+
+static char *util_read(char *path, long *len)
+{
+	char *buf = NULL;
+	long sz = 0, n = 0, nr;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	do {
+		if (n == sz) {
+			sz = sz ? sz * 2 : 4096;
+			buf = realloc(buf, sz);
+		}
+		nr = read(fd, buf + n, sz - n);
+		n += nr > 0 ? nr : 0;
+	} while (nr > 0);
+	close(fd);
+	*len = n;
+	return buf;
+}
+
+/* prepare a request of the given kind; user < 0 selects a random user */
+static void req_make(struct cli *cli, int kind, int user)
+{
+	char line[LLEN];
+	cli->kind = kind;
+	if (kind == REG && user < 0)
+		snprintf(line, sizeof(line), "register b%08x pass\n", rand());
+	if (kind == REG && user >= 0)
+		snprintf(line, sizeof(line), "register load%04d pass\n", user);
+	if (user < 0)
+		user = rand() % users;
+	if (kind == REP)
+		snprintf(line, sizeof(line), "report %s\n", cont);
+	if (kind == SUB)
+		snprintf(line, sizeof(line), "submit load%04d pass %s c\n", user, cont);
+	cli->req_n = strlen(line) + (kind == SUB ? prog_n + 4 : 0);
+	cli->req = malloc(cli->req_n);
+	memcpy(cli->req, line, strlen(line));
+	if (kind == SUB) {
+		memcpy(cli->req + strlen(line), prog, prog_n);
+		memcpy(cli->req + cli->req_n - 4, "EOF\n", 4);
+	}
+	cli->req_off = 0;
+	cli->recvd = 0;
+}
+
+static int req_kind(void)
+{
+	int r = rand() % (weights[0] + weights[1] + weights[2]);
+	if (r < weights[0])
+		return REG;
+	return r < weights[0] + weights[1] ? REP : SUB;
+}
+
+static int req_beg(struct cli *cli, int kind, int user)
+{
+	req_make(cli, kind, user);
+	cli->beg = util_us();
+	cli->fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+	if (cli->fd < 0)
+		return 1;
+	fcntl(cli->fd, F_SETFL, fcntl(cli->fd, F_GETFL) | O_NONBLOCK);
+	if (connect(cli->fd, addr->ai_addr, addr->ai_addrlen) < 0 &&
+			errno != EINPROGRESS) {
+		close(cli->fd);
+		cli->fd = -1;
+		return 1;
+	}
+	return 0;
+}
+
+static void req_end(struct cli *cli)
+{
+	if (cli->recvd > 0 && lat_n[cli->kind] < MAXREQS)
+		lat[cli->kind][lat_n[cli->kind]++] = util_us() - cli->beg;
+	if (cli->recvd == 0)
+		fails[cli->kind]++;
+	bytes += cli->recvd;
+	close(cli->fd);
+	free(cli->req);
+	cli->fd = -1;
+}
+
+/* handle the events of a connection; return nonzero when finished */
+static int req_poll(struct cli *cli, int events)
+{
+	char buf[1 << 14];
+	long n;
+	if (cli->req_off < cli->req_n && (events & POLLOUT)) {
+		n = write(cli->fd, cli->req + cli->req_off, cli->req_n - cli->req_off);
+		if (n < 0 && errno != EAGAIN)
+			return 1;
+		if (n > 0)
+			cli->req_off += n;
+		if (cli->req_off == cli->req_n)
+			shutdown(cli->fd, SHUT_WR);
+	}
+	if (events & (POLLIN | POLLHUP | POLLERR)) {
+		while ((n = read(cli->fd, buf, sizeof(buf))) > 0)
+			cli->recvd += n;
+		if (n == 0 || (n < 0 && errno != EAGAIN))
+			return 1;
+	}
+	return 0;
+}
+
+static int longcmp(const void *v1, const void *v2)
+{
+	long a = *(long *) v1, b = *(long *) v2;
+	return a < b ? -1 : a > b;
+}
+
+/* the p-th percentile of the sorted array a */
+static long pct(long *a, long n, int p)
+{
+	long i = (n * p + 99) / 100 - 1;
+	return n ? a[i > 0 ? i : 0] : 0;
+}
+
+/* register the submitting users, one at a time */
+static void users_register(void)
+{
+	struct cli cli;
+	struct pollfd pfd;
+	int i;
+	for (i = 0; i < users; i++) {
+		if (req_beg(&cli, REG, i)) {
+			free(cli.req);
+			continue;
+		}
+		pfd.fd = cli.fd;
+		pfd.events = POLLIN | POLLOUT;
+		while (poll(&pfd, 1, 1000) > 0 && !req_poll(&cli, pfd.revents))
+			pfd.events = cli.req_off < cli.req_n ? POLLIN | POLLOUT : POLLIN;
+		close(cli.fd);
+		free(cli.req);
+	}
+}
+
+static void printusage(char *prog)
+{
+	printf("Usage: %s [options] [program.c]\n\n", prog);
+	printf("Options:\n");
+	printf("  -a addr \t server address (127.0.0.1)\n");
+	printf("  -p port \t server port (40)\n");
+	printf("  -c n    \t concurrent connections (16)\n");
+	printf("  -n n    \t number of requests (1000)\n");
+	printf("  -r n    \t requests started per second (unlimited)\n");
+	printf("  -m r,p,s\t weights of register, report and submit (1,8,1)\n");
+	printf("  -u n    \t number of submitting users (100)\n");
+	printf("  -C cont \t contest for report and submit (c1)\n");
+	printf("  -R      \t register the submitting users first\n");
+}
+
+int main(int argc, char *argv[])
+{
+	char *host = "127.0.0.1", *port = "40";
+	struct addrinfo hints;
+	static struct pollfd pfds[MAXCONNS];
+	static struct cli clis[MAXCONNS];
+	int conns = 16, reqs = 1000, rate = 0, reg = 0;
+	int started = 0, done = 0;
+	long beg, end;
+	int i, k;
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (argv[i][1] == 'a')
+			host = argv[i][2] ? argv[i] + 2 : argv[++i];
+		if (argv[i][1] == 'p')
+			port = argv[i][2] ? argv[i] + 2 : argv[++i];
+		if (argv[i][1] == 'c')
+			conns = atoi(argv[i][2] ? argv[i] + 2 : argv[++i]);
+		if (argv[i][1] == 'n')
+			reqs = atoi(argv[i][2] ? argv[i] + 2 : argv[++i]);
+		if (argv[i][1] == 'r')
+			rate = atoi(argv[i][2] ? argv[i] + 2 : argv[++i]);
+		if (argv[i][1] == 'u')
+			users = atoi(argv[i][2] ? argv[i] + 2 : argv[++i]);
+		if (argv[i][1] == 'C')
+			cont = argv[i][2] ? argv[i] + 2 : argv[++i];
+		if (argv[i][1] == 'R')
+			reg = 1;
+		if (argv[i][1] == 'm')
+			sscanf(argv[i][2] ? argv[i] + 2 : argv[++i], "%d,%d,%d",
+				&weights[0], &weights[1], &weights[2]);
+		if (argv[i][1] == 'h') {
+			printusage(argv[0]);
+			return 0;
+		}
+	}
+	if (conns < 1 || conns > MAXCONNS || users < 1 ||
+			weights[0] + weights[1] + weights[2] <= 0) {
+		printusage(argv[0]);
+		return 1;
+	}
+	if (i < argc && !(prog = util_read(argv[i], &prog_n))) {
+		fprintf(stderr, "ctload: cannot read %s\n", argv[i]);
+		return 1;
+	}
+	if (!prog) {
+		prog = "int main(void)\n{\n\treturn 0;\n}\n";
+		prog_n = strlen(prog);
+	}
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host, port, &hints, &addr)) {
+		fprintf(stderr, "ctload: cannot resolve %s\n", host);
+		return 1;
+	}
+	srand(getpid());
+	if (reg)
+		users_register();
+	for (i = 0; i < conns; i++)
+		clis[i].fd = -1;
+	beg = util_us();
+	while (done < reqs) {
+		long now = util_us();
+		int timeout = -1;
+		for (i = 0; i < conns; i++) {
+			if (clis[i].fd >= 0 || started >= reqs)
+				continue;
+			if (rate > 0 && started >= (now - beg) * rate / 1000000) {
+				timeout = 1;
+				break;
+			}
+			started++;
+			if (req_beg(&clis[i], req_kind(), -1)) {
+				fails[clis[i].kind]++;
+				free(clis[i].req);
+				done++;
+			}
+		}
+		for (i = 0; i < conns; i++) {
+			pfds[i].fd = clis[i].fd;
+			pfds[i].events = POLLIN;
+			if (clis[i].fd >= 0 && clis[i].req_off < clis[i].req_n)
+				pfds[i].events |= POLLOUT;
+		}
+		if (poll(pfds, conns, timeout) < 0 && errno != EINTR)
+			break;
+		for (i = 0; i < conns; i++) {
+			if (clis[i].fd < 0 || !pfds[i].revents)
+				continue;
+			if (req_poll(&clis[i], pfds[i].revents)) {
+				req_end(&clis[i]);
+				done++;
+			}
+		}
+	}
+	end = util_us();
+	printf("requests\t%d\t%.3f s\t%.1f req/s\t%ld bytes\n", done,
+		(end - beg) / 1e6, done * 1e6 / (end - beg), bytes);
+	printf("request\tcount\tfailed\tp50_us\tp99_us\tmax_us\n");
+	for (k = 0; k < 3; k++) {
+		qsort(lat[k], lat_n[k], sizeof(lat[k][0]), longcmp);
+		printf("%s\t%ld\t%ld\t%ld\t%ld\t%ld\n", kinds[k], lat_n[k],
+			fails[k], pct(lat[k], lat_n[k], 50),
+			pct(lat[k], lat_n[k], 99),
+			lat_n[k] ? lat[k][lat_n[k] - 1] : 0);
+	}
+	freeaddrinfo(addr);
+	return 0;
+}
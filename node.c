@@ -0,0 +1,291 @@
+/* Challenging Thursdays Judge Node */
+#include <ctype.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "conn.h"
+#include "util.h"
+
+#define NODEPORT	"41"		/* default node port */
+#define NODECONNS	16		/* maximum server connections */
+#define LLEN		256		/* maximum input line length */
+#define CTSUBSZ		(1 << 16)	/* maximum submission size */
+#define CTLOGS		"logs"		/* directory to store the logs */
+#define CTRESULT	"logs/node%02d.out"	/* verification results file */
+#define CTSOURCE	"logs/node%ld.src"	/* received programs */
+#define CTUID		12345		/* sandbox uid of the first judge */
+
+#define LEN(a)		((sizeof(a)) / sizeof((a)[0]))
+#define MIN(a, b)	((a) < (b) ? (a) : (b))
+
+/* a received submission */
+struct job {
+	long id;			/* submission id in the server */
+	char cont[LLEN];		/* contest name */
+	char lang[LLEN];		/* submission language */
+	char path[LLEN];		/* program path */
+	int cli;			/* requesting connection */
+	int gen;			/* clis_gen[cli] when received */
+	struct job *next;		/* next queued job */
+};
+
+/* judge workers */
+struct judge {
+	int pid;			/* pid of verifying program */
+	struct job *job;		/* the program being tested */
+};
+
+static struct conn *clis[NODECONNS];	/* server connections */
+static int clis_gen[NODECONNS];		/* incremented when a slot is reused */
+static struct job *jobs_head;		/* queued jobs */
+static struct job *jobs_tail;		/* the last queued job */
+static long jobs_seq;			/* the number of received jobs */
+static struct judge *judges;		/* judge workers */
+static int judges_n;			/* number of judge workers */
+static char *node_cgroup;		/* cgroup v2 directory for test programs */
+static int node_uid = CTUID;		/* sandbox uid of the first judge */
+
+/* check contest and language names received from the server */
+static int nameok(char *s, char *extra)
+{
+	if (!s[0] || s[0] == '.')
+		return 0;
+	for (; *s; s++)
+		if (!isalnum((unsigned char) *s) && !strchr(extra, *s))
+			return 0;
+	return 1;
+}
+
+/* send the result of a job; the output of test follows its length */
+static void job_done(struct job *job, int fd)
+{
+	struct stat st;
+	struct conn *conn = clis[job->cli];
+	if (conn && clis_gen[job->cli] == job->gen) {
+		if (fd < 0 || fstat(fd, &st) < 0)
+			st.st_size = 0;
+		if (st.st_size > 0)
+			conn_printf(conn, "done %ld %ld\n", job->id, (long) st.st_size);
+		else			/* rejected or test failed */
+			conn_printf(conn, "fail %ld\n", job->id);
+		if (st.st_size > 0 && conn_sendfile(conn, fd, st.st_size))
+			conn_hang(conn);	/* the header is sent without its body */
+		if (st.st_size > 0)
+			fd = -1;		/* closed by conn_sendfile() */
+		conn_poll(conn, POLLWRNORM);
+	}
+	if (fd >= 0)
+		close(fd);
+	unlink(job->path);
+	free(job);
+}
+
+/* begin testing a job in judge j */
+static void test_beg(int j)
+{
+	struct judge *judge = &judges[j];
+	struct job *job = jobs_head;
+	char res[LLEN];
+	jobs_head = job->next;
+	if (!jobs_head)
+		jobs_tail = NULL;
+	judge->job = job;
+	snprintf(res, sizeof(res), CTRESULT, j);
+	judge->pid = util_judge(node_uid + j, node_cgroup, job->cont,
+			job->path, job->lang, res);
+	if (judge->pid < 0) {
+		judge->pid = 0;
+		judge->job = NULL;
+		job_done(job, -1);
+	}
+}
+
+/* start testing queued jobs in idle judges */
+static void test_all(void)
+{
+	int i;
+	for (i = 0; i < judges_n && jobs_head; i++)
+		if (!judges[i].pid)
+			test_beg(i);
+}
+
+/* collect the results of terminated verification programs */
+static void test_reap(int sfd)
+{
+	char path[LLEN];
+	int pid, fd, i;
+	while ((pid = util_reap(sfd)) > 0) {
+		for (i = 0; i < judges_n; i++) {
+			if (judges[i].pid != pid)
+				continue;
+			snprintf(path, sizeof(path), CTRESULT, i);
+			fd = open(path, O_RDONLY | O_CLOEXEC);
+			unlink(path);		/* the next test creates a new file */
+			job_done(judges[i].job, fd);
+			judges[i].job = NULL;
+			judges[i].pid = 0;
+		}
+	}
+	test_all();
+}
+
+/* queue a job; the program is in buf */
+static void node_job(int c, char *req, void *buf, long len)
+{
+	struct job *job = malloc(sizeof(*job));
+	int fd;
+	if (!job)
+		return;
+	memset(job, 0, sizeof(*job));
+	sscanf(req, "job %ld %255s %255s", &job->id, job->cont, job->lang);
+	job->cli = c;
+	job->gen = clis_gen[c];
+	snprintf(job->path, sizeof(job->path), CTSOURCE, jobs_seq++);
+	fd = open(job->path, O_WRONLY | O_TRUNC | O_CREAT | O_CLOEXEC, 0600);
+	if (fd < 0 || write(fd, buf, len) != len ||
+			!nameok(job->cont, "_-") || !util_isdir(job->cont) ||
+			!nameok(job->lang, "+")) {
+		if (fd >= 0)
+			close(fd);
+		job_done(job, -1);
+		return;
+	}
+	close(fd);
+	if (jobs_tail)
+		jobs_tail->next = job;
+	else
+		jobs_head = job;
+	jobs_tail = job;
+}
+
+/* handle the requests of server connection c */
+static void node_serve(int c)
+{
+	struct conn *conn = clis[c];
+	char req[LLEN];
+	long id, len, hdr;
+	void *buf;
+	long buflen;
+	char *eol;
+	while (!conn_recvbuf(conn, &buf, &buflen) && !conn_hung(conn)) {
+		if (!(eol = memchr(buf, '\n', MIN(buflen, LLEN)))) {
+			if (buflen >= LLEN)
+				conn_hang(conn);
+			break;
+		}
+		hdr = eol + 1 - (char *) buf;
+		memcpy(req, buf, hdr - 1);
+		req[hdr - 1] = '\0';
+		if (!strcmp("ping", req)) {
+			conn_printf(conn, "pong\n");
+			conn_recv(conn, NULL, hdr);
+		} else if (sscanf(req, "job %ld %*s %*s %ld", &id, &len) == 2 &&
+				len >= 0 && len <= CTSUBSZ) {
+			if (buflen < hdr + len)
+				break;
+			node_job(c, req, eol + 1, len);
+			conn_recv(conn, NULL, hdr + len);
+		} else {
+			conn_hang(conn);
+		}
+	}
+	test_all();
+}
+
+static void printusage(char *prog)
+{
+	printf("Usage: %s [options]\n\n", prog);
+	printf("Options:\n");
+	printf("  -p port \t set node port number (%s)\n", NODEPORT);
+	printf("  -j n    \t number of judge workers (processor count)\n");
+	printf("  -g dir  \t cgroup v2 directory for test programs\n");
+	printf("  -u uid  \t sandbox uid of the first judge (%d)\n", CTUID);
+}
+
+int main(int argc, char *argv[])
+{
+	struct pollfd pfds[NODECONNS + 2];
+	char *port = NODEPORT;
+	sigset_t mask;
+	int ifd, sfd;
+	int i;
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (argv[i][1] == 'p')
+			port = argv[i][2] ? argv[i] + 2 : argv[++i];
+		if (argv[i][1] == 'j')
+			judges_n = atoi(argv[i][2] ? argv[i] + 2 : argv[++i]);
+		if (argv[i][1] == 'g')
+			node_cgroup = argv[i][2] ? argv[i] + 2 : argv[++i];
+		if (argv[i][1] == 'u')
+			node_uid = atoi(argv[i][2] ? argv[i] + 2 : argv[++i]);
+		if (argv[i][1] == 'h') {
+			printusage(argv[0]);
+			return 0;
+		}
+	}
+	if (judges_n <= 0)
+		judges_n = sysconf(_SC_NPROCESSORS_ONLN);
+	if (judges_n <= 0)
+		judges_n = 1;
+	judges = calloc(judges_n, sizeof(judges[0]));
+	mkdir(CTLOGS, 0700);
+	signal(SIGPIPE, SIG_IGN);
+	sigemptyset(&mask);		/* SIGCHLD is delivered via sfd */
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+	sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	ifd = util_mksocket(NULL, port);
+	if (ifd < 0 || sfd < 0) {
+		fprintf(stderr, "node: cannot listen on port %s\n", port);
+		return 1;
+	}
+	while (1) {
+		pfds[0].fd = ifd;
+		pfds[0].events = POLLIN;
+		pfds[1].fd = sfd;
+		pfds[1].events = POLLIN;
+		for (i = 0; i < NODECONNS; i++) {
+			pfds[i + 2].fd = clis[i] ? conn_fd(clis[i]) : -1;
+			pfds[i + 2].events = clis[i] ? conn_events(clis[i]) : 0;
+		}
+		if (poll(pfds, LEN(pfds), -1) < 0)
+			continue;
+		if (pfds[0].revents & POLLIN) {
+			int cfd = accept(ifd, NULL, NULL);
+			for (i = 0; cfd >= 0 && i < NODECONNS && clis[i]; i++)
+				;
+			if (cfd >= 0 && i == NODECONNS)
+				close(cfd);
+			if (cfd >= 0 && i < NODECONNS) {
+				fcntl(cfd, F_SETFD, fcntl(cfd, F_GETFD) | FD_CLOEXEC);
+				fcntl(cfd, F_SETFL, fcntl(cfd, F_GETFL) | O_NONBLOCK);
+				clis[i] = conn_make(cfd);
+				clis_gen[i]++;
+				conn_printf(clis[i], "hello %d\n", judges_n);
+			}
+		}
+		if (pfds[1].revents & POLLIN)
+			test_reap(sfd);
+		for (i = 0; i < NODECONNS; i++) {
+			if (!clis[i] || !pfds[i + 2].revents)
+				continue;
+			if (conn_poll(clis[i], pfds[i + 2].revents))
+				conn_hang(clis[i]);
+			node_serve(i);
+			if (!(conn_events(clis[i]) & POLLRDNORM))
+				conn_hang(clis[i]);
+			if (conn_hung(clis[i])) {
+				conn_free(clis[i]);
+				clis[i] = NULL;
+			}
+		}
+	}
+	return 0;
+}
@@ -1,14 +1,6 @@
 #!/bin/sh
 # Retry Challanging Thursdays submissions
 #
-# Usage: retest.sh ctxy <ctxy.stat
+# Usage: retest.sh ctxy <ctxy.stat >ctxy.stat.new
 
-while read ln
-do
-	SNAME="`echo $ln | cut -d ' ' -f1`"
-	STIME="`echo $ln | cut -d ' ' -f2`"
-	SFILE="`echo logs/$1-$STIME-$SNAME*`"
-	SLANG="`echo $SFILE | sed 's/^.*\.//'`"
-	echo -n "$SNAME	$STIME	"
-	./test $1 $SFILE $SLANG
-done
+exec ./test -c logs/cache -j "`nproc`" -R $1
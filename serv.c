@@ -18,46 +18,55 @@
 /* Challenging Thursdays Server */
 #include <arpa/inet.h>
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <netinet/in.h>
 #include <netdb.h>
 #include <poll.h>
 #include <signal.h>
-#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
-#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 #include "conn.h"
+#include "util.h"
 
 #define CTPORT		"40"		/* default server port */
-#define CTCONNS		16		/* maximum simultaneous connections */
+#define CTCONNS		256		/* maximum simultaneous connections */
+#define CTEVENTS	64		/* events handled in each ct_poll() */
 #define LLEN		256		/* maximum input line length */
-#define CTSUBS		32		/* maximum queued submissions */
 #define CTTIMEOUT	10		/* connection timeout in seconds */
-#define CTRATECNT	32		/* user count in ratelimit_* */
 #define CTSUBSZ		(1 << 16)	/* maximum submission size */
 #define CTUSERS		"USERS"		/* file containing the list of users */
 #define CTLOGS		"logs"		/* directory to store the logs */
-#define CTTEST		"./test"	/* verification program */
-#define CTRESULT	"logs/test.out"	/* verification results file */
+#define CTRESULT	"logs/test%02d.out"	/* verification results file */
+#define CTUID		12345		/* sandbox uid of the first judge */
+#define CTQUEUE		"logs/queue"	/* submission queue journal */
 #define CTEOF		"EOF\n"		/* default eof mark */
+#define CTHASH		4096		/* size of hash tables */
+#define CTPING		2		/* seconds between node heartbeats */
+#define CTNODEDEAD	10		/* seconds before dropping a silent node */
 
-static int ct_reggap = 40;	/* minimum gap between registerations */
+static int ct_reggap = 40;	/* minimum gap between registerations of an address */
 static int ct_subgap = 120;	/* minimum gap between submissions of a user */
+static int ct_regburst = 1;	/* registerations allowed without a gap */
+static int ct_subburst = 1;	/* submissions allowed without a gap */
+static int ct_conns = CTCONNS;	/* maximum simultaneous connections */
+static char *ct_cgroup;		/* cgroup v2 directory for test programs */
 
 #define LEN(a)		((sizeof(a)) / sizeof((a)[0]))
+#define MIN(a, b)	((a) < (b) ? (a) : (b))
+#define MAX(a, b)	((a) < (b) ? (b) : (a))
 
 /* conn struct extensions */
-static void conn_printf(struct conn *conn, char *fmt, ...);
 static int conn_eol(struct conn *conn);
 static int conn_recveol(struct conn *conn, char *buf, int len);
-static int conn_ends(struct conn *conn, char *s);
 
 /* pending submission */
 struct sub {
@@ -66,39 +75,46 @@ struct sub {
 	char lang[LLEN];		/* submission language */
 	char path[LLEN];		/* program path */
 	long date;			/* submission date */
-	int valid;			/* pending submission */
+	long qts;			/* queueing time (util_ms()) */
+	long tts;			/* testing time (util_ms()) */
+	long id;			/* submission id sent to judge nodes */
+	int local;			/* failed on a node; test it locally */
+	struct sub *prev, *next;	/* submission queue links */
+	struct sub *hnext;		/* next in subs_tab[] chain */
+};
+
+/* judge workers */
+struct judge {
+	int pid;			/* pid of verifying program */
+	struct sub *sub;		/* the program being tested */
+};
+
+/* remote judge nodes */
+struct node {
+	char host[LLEN];		/* node address */
+	char port[LLEN];		/* node port */
+	struct conn *conn;		/* connection; NULL if down */
+	int slots;			/* concurrent tests; zero before hello */
+	struct sub **subs;		/* the programs being tested */
+	int subs_n;			/* number of programs being tested */
+	long seen;			/* last message (util_ms()) */
 };
 
 static char **conts;			/* open contests */
 static int conts_n;			/* number of open contests */
-static struct sub subs[CTSUBS];		/* pending submissions */
-static int test_pid;			/* pid of verifying program */
-static int test_idx;			/* index of the program being tested */
-
-/* return a server socket listening on the given port */
-static int util_mksocket(char *addr, char *port)
-{
-	struct addrinfo hints, *addrinfo;
-	int fd;
-	int yes = 1;
-	memset(&hints, 0, sizeof(hints));
-	hints.ai_family = AF_INET;
-	hints.ai_socktype = SOCK_STREAM;
-	hints.ai_flags = addr ? 0 : AI_PASSIVE;
-	if (getaddrinfo(addr, port, &hints, &addrinfo))
-		return -1;
-	fd = socket(addrinfo->ai_family, addrinfo->ai_socktype,
-			addrinfo->ai_protocol);
-	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
-	fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
-	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
-	if (bind(fd, addrinfo->ai_addr, addrinfo->ai_addrlen) < 0)
-		return -1;
-	if (listen(fd, CTCONNS * 2))
-		return -1;
-	freeaddrinfo(addrinfo);
-	return fd;
-}
+static struct sub *subs_head;		/* the queue of untested submissions */
+static struct sub *subs_tail;		/* the last queued submission */
+static struct sub *subs_tab[CTHASH];	/* pending submissions by user and contest */
+static int subs_n;			/* number of pending submissions */
+static int subs_jfd = -1;		/* submission queue journal */
+static int subs_dirty;			/* subs_jfd needs fdatasync() */
+static long subs_id;			/* the last submission id */
+static struct judge *judges;		/* judge workers */
+static int judges_n = -1;		/* number of judge workers */
+static struct node *nodes;		/* remote judge nodes */
+static int nodes_n;			/* number of remote judge nodes */
+static int ct_efd;			/* epoll file descriptor */
+static int ct_spare = -1;		/* reserved for dropping connections without fds */
 
 /* copy spath into dpath */
 static int util_cp(char *spath, char *dpath)
@@ -120,158 +136,820 @@ static int util_cp(char *spath, char *dpath)
 	return failed;
 }
 
-static char ratelimit_user[CTRATECNT][LLEN];	/* submission user log */
-static long ratelimit_ts[CTRATECNT];		/* last submission timestamp */
+/* string hash (fnv-1a) */
+static unsigned hash(char *s)
+{
+	unsigned h = 2166136261u;
+	while (*s)
+		h = (h ^ (unsigned char) *s++) * 16777619u;
+	return h;
+}
+
+/* milliseconds since an arbitrary point */
+static long util_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* log-linear latency histograms, in milliseconds */
+#define HSUBS		8		/* buckets for each power of two */
+#define HLEN		256		/* number of buckets */
+
+struct hist {
+	long cnt[HLEN];			/* bucket counts */
+	long n;				/* number of samples */
+	long sum;			/* sum of samples */
+	long max;			/* largest sample */
+};
+
+static struct hist stat_wait;		/* queue wait */
+static struct hist stat_judge;		/* judge duration */
+static struct hist stat_comp;		/* compilation time */
+static long stat_reqs;			/* requests */
+static long stat_subs;			/* queued submissions */
+static long stat_rejects;		/* connections rejected by accept */
+static long stat_timeouts;		/* connections closed for timeout */
+
+static int hist_idx(long v)
+{
+	int e = 0;
+	if (v < HSUBS)
+		return v > 0 ? v : 0;
+	while ((v >> e) >= HSUBS * 2)
+		e++;
+	return MIN(HLEN - 1, (e + 1) * HSUBS + (v >> e) - HSUBS);
+}
+
+/* the smallest value of bucket i */
+static long hist_val(int i)
+{
+	if (i < HSUBS)
+		return i;
+	return (long) (HSUBS + i % HSUBS) << (i / HSUBS - 1);
+}
+
+static void hist_add(struct hist *h, long v)
+{
+	h->cnt[hist_idx(v)]++;
+	h->n++;
+	h->sum += v;
+	h->max = MAX(h->max, v);
+}
 
-static int ratelimit_register(void)
+/* the p-th percentile */
+static long hist_pct(struct hist *h, int p)
 {
-	static long ts;
-	if (ts && ts + ct_reggap > time(NULL))
-		return ts + ct_reggap - time(NULL);
-	ts = time(NULL);
+	long n = (h->n * p + 99) / 100;
+	long c = 0;
+	int i;
+	for (i = 0; i < HLEN; i++)
+		if ((c += h->cnt[i]) >= n && c > 0)
+			return hist_val(i);
 	return 0;
 }
 
-static int ratelimit_submit(char *user)
+/* token buckets; the credit is in milliseconds */
+struct bucket {
+	char key[LLEN];			/* user name or address */
+	long credit;			/* accumulated credit */
+	long ts;			/* last update (util_ms()) */
+	struct bucket *next;		/* next bucket in the hash chain */
+};
+
+static struct bucket *ratelimit_sub[CTHASH];	/* submissions per user */
+static struct bucket *ratelimit_reg[CTHASH];	/* registrations per address */
+
+/* take a token from key's bucket; return the seconds to wait if empty */
+static int ratelimit(struct bucket **tab, char *key, int gap, int burst)
 {
-	long now = time(NULL);
-	int i, j;
-	for (i = 0; i < LEN(ratelimit_ts); i++)
-		if (!strcmp(ratelimit_user[i], user))
-			break;
-	if (i < LEN(ratelimit_ts) && ratelimit_ts[i] + ct_subgap > now)
-		return ratelimit_ts[i] + ct_subgap - now;
-	if (i == LEN(ratelimit_ts)) {
-		i = 0;
-		for (j = 0; j < LEN(ratelimit_ts); j++)
-			if (ratelimit_ts[j] < ratelimit_ts[i])
-				i = j;
-		strcpy(ratelimit_user[i], user);
-	}
-	ratelimit_ts[i] = now;
+	struct bucket **pb = &tab[hash(key) % CTHASH];
+	struct bucket *b, *cur = NULL;
+	long now = util_ms();
+	long cost = gap * 1000l;
+	long cap = cost * burst;
+	while ((b = *pb)) {
+		b->credit = MIN(cap, b->credit + now - b->ts);
+		b->ts = now;
+		if (!strcmp(key, b->key)) {
+			cur = b;
+		} else if (b->credit >= cap) {	/* full buckets are evicted */
+			*pb = b->next;
+			free(b);
+			continue;
+		}
+		pb = &b->next;
+	}
+	if (!cur && (cur = malloc(sizeof(*cur)))) {
+		snprintf(cur->key, sizeof(cur->key), "%s", key);
+		cur->credit = cap;
+		cur->ts = now;
+		cur->next = tab[hash(key) % CTHASH];
+		tab[hash(key) % CTHASH] = cur;
+	}
+	if (!cur)
+		return 0;
+	if (cur->credit < cost)
+		return (cost - cur->credit + 999) / 1000;
+	cur->credit -= cost;
 	return 0;
 }
 
-/* log in a user; return nonzero on failure */
-static int users_login(char *quser, char *qpass)
+static int ratelimit_register(char *addr)
+{
+	return ratelimit(ratelimit_reg, addr, ct_reggap, ct_regburst);
+}
+
+static int ratelimit_submit(char *user)
+{
+	return ratelimit(ratelimit_sub, user, ct_subgap, ct_subburst);
+}
+
+/* registered users */
+struct user {
+	char name[LLEN];		/* user name */
+	char pass[LLEN];		/* password */
+	struct user *next;		/* next user in the hash chain */
+};
+
+static struct user *users[CTHASH];	/* users hash table */
+static struct stat users_st;		/* CTUSERS when users[] was loaded */
+
+static struct user *users_find(char *name)
+{
+	struct user *u = users[hash(name) % CTHASH];
+	while (u && strcmp(u->name, name))
+		u = u->next;
+	return u;
+}
+
+static void users_put(char *name, char *pass)
+{
+	struct user *u = users_find(name);
+	if (!u) {
+		int h = hash(name) % CTHASH;
+		if (!(u = malloc(sizeof(*u))))
+			return;
+		strcpy(u->name, name);
+		u->next = users[h];
+		users[h] = u;
+	}
+	strcpy(u->pass, pass);
+}
+
+/* load CTUSERS into users[], if it has changed */
+static void users_load(void)
 {
 	char line[LLEN], user[LLEN], pass[LLEN];
-	FILE *fp = fopen(CTUSERS, "r");
-	int logged = 0;
-	if (!fp)
-		return 1;
-	while (fgets(line, sizeof(line), fp)) {
-		if (sscanf(line, "%s %s", user, pass) != 2)
-			continue;
-		if (!strcmp(quser, user))
-			logged = qpass == NULL || !strcmp(qpass, pass);
+	struct stat st;
+	FILE *fp;
+	int i;
+	if (stat(CTUSERS, &st) < 0)
+		memset(&st, 0, sizeof(st));
+	if (st.st_ino == users_st.st_ino && st.st_size == users_st.st_size &&
+			st.st_mtim.tv_sec == users_st.st_mtim.tv_sec &&
+			st.st_mtim.tv_nsec == users_st.st_mtim.tv_nsec)
+		return;
+	for (i = 0; i < CTHASH; i++) {
+		while (users[i]) {
+			struct user *u = users[i];
+			users[i] = u->next;
+			free(u);
+		}
 	}
+	users_st = st;
+	if (!(fp = fopen(CTUSERS, "r")))
+		return;
+	while (fgets(line, sizeof(line), fp))
+		if (sscanf(line, "%s %s", user, pass) == 2)
+			users_put(user, pass);
 	fclose(fp);
-	return !logged;
+}
+
+/* log in a user; return nonzero on failure */
+static int users_login(char *quser, char *qpass)
+{
+	struct user *u;
+	users_load();
+	u = users_find(quser);
+	return !u || (qpass != NULL && strcmp(qpass, u->pass));
 }
 
 /* add the given user */
 static void users_add(char *user, char *pass)
 {
 	FILE *fp = fopen(CTUSERS, "a");
+	users_load();
+	if (!fp)
+		return;
 	fprintf(fp, "%s %s\n", user, pass);
 	fclose(fp);
+	users_put(user, pass);
+	stat(CTUSERS, &users_st);
+}
+
+static unsigned subs_hash(char *user, char *cont)
+{
+	return (hash(user) ^ hash(cont) * 31) % CTHASH;
 }
 
 /* find the submission from the given user and for the given contest */
-static int subs_find(char *user, char *cont)
+static struct sub *subs_find(char *user, char *cont)
 {
-	int i;
-	for (i = 0; i < LEN(subs); i++)
-		if (subs[i].valid && !strcmp(user, subs[i].user) &&
-				!strcmp(cont, subs[i].cont))
-			return i;
-	return -1;
+	struct sub *sub = subs_tab[subs_hash(user, cont)];
+	while (sub && (strcmp(user, sub->user) || strcmp(cont, sub->cont)))
+		sub = sub->hnext;
+	return sub;
 }
 
-/* find the first unprocessed submission */
-static int subs_first(void)
+/* submissions being uploaded */
+struct upload {
+	char user[LLEN];		/* submitting user */
+	char cont[LLEN];		/* contest name */
+	struct upload *next;		/* next in uploads[] chain */
+};
+
+static struct upload *uploads[CTHASH];
+
+/* record an upload; return nonzero if user is uploading for cont */
+static int uploads_add(char *user, char *cont)
 {
-	int i;
-	for (i = 0; i < LEN(subs); i++)
-		if (subs[i].valid)
-			return i;
-	return -1;
+	struct upload *up = uploads[subs_hash(user, cont)];
+	while (up && (strcmp(user, up->user) || strcmp(cont, up->cont)))
+		up = up->next;
+	if (up || !(up = malloc(sizeof(*up))))
+		return 1;
+	snprintf(up->user, sizeof(up->user), "%s", user);
+	snprintf(up->cont, sizeof(up->cont), "%s", cont);
+	up->next = uploads[subs_hash(user, cont)];
+	uploads[subs_hash(user, cont)] = up;
+	return 0;
+}
+
+static void uploads_del(char *user, char *cont)
+{
+	struct upload **pu = &uploads[subs_hash(user, cont)];
+	struct upload *up;
+	while ((up = *pu) && (strcmp(user, up->user) || strcmp(cont, up->cont)))
+		pu = &up->next;
+	if (up) {
+		*pu = up->next;
+		free(up);
+	}
+}
+
+/* remove the first untested submission from the queue */
+static struct sub *subs_pop(void)
+{
+	struct sub *sub = subs_head;
+	if (sub) {
+		subs_head = sub->next;
+		if (subs_head)
+			subs_head->prev = NULL;
+		else
+			subs_tail = NULL;
+		sub->next = NULL;
+	}
+	return sub;
+}
+
+/* return a submission to the front of the queue */
+static void subs_push(struct sub *sub)
+{
+	sub->prev = NULL;
+	sub->next = subs_head;
+	if (subs_head)
+		subs_head->prev = sub;
+	else
+		subs_tail = sub;
+	subs_head = sub;
+}
+
+/* append a line to the submission queue journal */
+static void subs_journal(int op, struct sub *sub)
+{
+	char line[LLEN * 5];
+	int len;
+	if (subs_jfd < 0)
+		return;
+	if (op == '+')
+		len = snprintf(line, sizeof(line), "+ %ld %s %s %s %s\n",
+			sub->date, sub->user, sub->cont, sub->lang, sub->path);
+	else
+		len = snprintf(line, sizeof(line), "- %ld %s %s\n",
+			sub->date, sub->user, sub->cont);
+	if (write(subs_jfd, line, len) == len)
+		subs_dirty = 1;
+}
+
+/* flush the journal; called once in each iteration of the event loop */
+static void subs_sync(void)
+{
+	if (subs_dirty && subs_jfd >= 0)
+		fdatasync(subs_jfd);
+	subs_dirty = 0;
+}
+
+/* insert a submission into the queue and the index */
+static struct sub *subs_put(char *user, char *cont, char *lang, char *path, long date)
+{
+	struct sub *sub = malloc(sizeof(*sub));
+	int h = subs_hash(user, cont);
+	if (!sub)
+		return NULL;
+	memset(sub, 0, sizeof(*sub));
+	snprintf(sub->user, sizeof(sub->user), "%s", user);
+	snprintf(sub->cont, sizeof(sub->cont), "%s", cont);
+	snprintf(sub->lang, sizeof(sub->lang), "%s", lang);
+	snprintf(sub->path, sizeof(sub->path), "%s", path);
+	sub->date = date;
+	sub->qts = util_ms();
+	sub->id = ++subs_id;
+	sub->prev = subs_tail;
+	if (subs_tail)
+		subs_tail->next = sub;
+	else
+		subs_head = sub;
+	subs_tail = sub;
+	sub->hnext = subs_tab[h];
+	subs_tab[h] = sub;
+	subs_n++;
+	return sub;
+}
+
+/* remove a submission from the index and, if still queued, the queue */
+static void subs_del(struct sub *sub)
+{
+	struct sub **p = &subs_tab[subs_hash(sub->user, sub->cont)];
+	while (*p != sub)
+		p = &(*p)->hnext;
+	*p = sub->hnext;
+	if (sub->prev || subs_head == sub) {
+		if (sub->prev)
+			sub->prev->next = sub->next;
+		else
+			subs_head = sub->next;
+		if (sub->next)
+			sub->next->prev = sub->prev;
+		else
+			subs_tail = sub->prev;
+	}
+	free(sub);
+	subs_n--;
 }
 
 /* queue the given submission */
 static int subs_add(char *user, char *cont, char *lang, char *path)
 {
 	char backup[LLEN];
+	struct sub *sub = subs_put(user, cont, lang, path, time(NULL));
+	if (sub) {
+		snprintf(backup, sizeof(backup), "%s/%s-%ld-%s.%s",
+			CTLOGS, cont, sub->date, user, lang);
+		util_cp(path, backup);
+		snprintf(sub->path, sizeof(sub->path), "%s", backup);
+		subs_journal('+', sub);
+	}
+	return sub == NULL;
+}
+
+/* a tested submission; truncate the journal if nothing is pending */
+static void subs_done(struct sub *sub)
+{
+	subs_journal('-', sub);
+	subs_del(sub);
+	if (!subs_n && subs_jfd >= 0)
+		ftruncate(subs_jfd, 0);
+}
+
+/* replay the submission queue journal and compact it */
+static void subs_load(void)
+{
+	char line[LLEN * 5], user[LLEN], cont[LLEN], lang[LLEN], path[LLEN];
+	char tmp[LLEN];
+	struct sub *sub;
+	long date;
+	FILE *fp;
+	int dfd;
+	mkdir(CTLOGS, 0700);
+	if ((fp = fopen(CTQUEUE, "r"))) {
+		while (fgets(line, sizeof(line), fp)) {
+			if (sscanf(line, "+ %ld %s %s %s %s", &date,
+					user, cont, lang, path) == 5)
+				if (!subs_find(user, cont))
+					subs_put(user, cont, lang, path, date);
+			if (sscanf(line, "- %ld %s %s", &date, user, cont) == 3)
+				if ((sub = subs_find(user, cont)) && sub->date == date)
+					subs_del(sub);
+		}
+		fclose(fp);
+	}
+	snprintf(tmp, sizeof(tmp), "%s.tmp", CTQUEUE);
+	subs_jfd = open(tmp, O_WRONLY | O_TRUNC | O_CREAT | O_CLOEXEC, 0600);
+	for (sub = subs_head; sub; sub = sub->next)
+		subs_journal('+', sub);
+	if (subs_jfd >= 0 && (fsync(subs_jfd) || rename(tmp, CTQUEUE))) {
+		close(subs_jfd);
+		subs_jfd = -1;
+	}
+	if (subs_jfd >= 0 && (dfd = open(CTLOGS, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) >= 0) {
+		fsync(dfd);		/* make the rename durable */
+		close(dfd);
+	}
+	subs_dirty = 0;
+	if (subs_jfd >= 0)
+		fcntl(subs_jfd, F_SETFL, fcntl(subs_jfd, F_GETFL) | O_APPEND);
+	else
+		fprintf(stderr, "serv: cannot write %s\n", CTQUEUE);
+}
+
+static int conts_find(char *cont)
+{
 	int i;
-	for (i = 0; i < LEN(subs); i++) {
-		if (!subs[i].valid) {
-			subs[i].date = time(NULL);
-			strcpy(subs[i].cont, cont);
-			strcpy(subs[i].lang, lang);
-			strcpy(subs[i].path, path);
-			strcpy(subs[i].user, user);
-			subs[i].valid = 1;
-			snprintf(backup, sizeof(backup), "%s/%s-%ld-%s.%s",
-				CTLOGS, cont, subs[i].date, user, lang);
-			util_cp(path, backup);
-			return 0;
+	for (i = 0; i < conts_n; i++)
+		if (!strcmp(cont, conts[i]))
+			return i;
+	return -1;
+}
+
+/* scoreboard entries */
+struct score {
+	char user[LLEN];		/* user name */
+	int best;			/* best score */
+	int tries;			/* number of submissions */
+	long last;			/* date of the last submission */
+	struct score *next;		/* next entry in the hash chain */
+};
+
+/* contest scoreboards */
+struct board {
+	struct score *tab[CTHASH];	/* entries hashed by user name */
+	struct score **all;		/* all entries */
+	int all_n, all_sz;		/* number and size of all[] */
+	char *out;			/* the formatted scoreboard */
+	long out_n;			/* length of out */
+	int dirty;			/* out needs updating */
+};
+
+static struct board *boards;		/* scoreboards of open contests */
+
+/* update the scoreboard of a contest with a result line */
+static void board_add(int c, char *user, long date, char *res)
+{
+	struct board *b = &boards[c];
+	struct score *e = b->tab[hash(user) % CTHASH];
+	int score = 0;
+	while (e && strcmp(e->user, user))
+		e = e->next;
+	if (!e) {
+		if (b->all_n == b->all_sz) {
+			int sz = b->all_sz ? b->all_sz * 2 : 64;
+			struct score **all = realloc(b->all, sz * sizeof(all[0]));
+			if (!all)
+				return;
+			b->all = all;
+			b->all_sz = sz;
 		}
+		if (!(e = calloc(1, sizeof(*e))))
+			return;
+		snprintf(e->user, sizeof(e->user), "%s", user);
+		e->next = b->tab[hash(user) % CTHASH];
+		b->tab[hash(user) % CTHASH] = e;
+		b->all[b->all_n++] = e;
+	}
+	sscanf(res, "%d", &score);
+	if (!e->tries || score > e->best)
+		e->best = score;
+	if (date > e->last)
+		e->last = date;
+	e->tries++;
+	b->dirty = 1;
+}
+
+static int scorecmp(const void *v1, const void *v2)
+{
+	struct score *s1 = *(struct score **) v1;
+	struct score *s2 = *(struct score **) v2;
+	if (s1->best != s2->best)
+		return s2->best - s1->best;
+	return strcmp(s1->user, s2->user);
+}
+
+/* format the scoreboard of a contest, if it has changed */
+static void board_make(int c)
+{
+	struct board *b = &boards[c];
+	long sz = 0;
+	int i;
+	if (!b->dirty)
+		return;
+	qsort(b->all, b->all_n, sizeof(b->all[0]), scorecmp);
+	for (i = 0; i < b->all_n; i++)
+		sz += strlen(b->all[i]->user) + 64;
+	free(b->out);
+	b->out = malloc(sz + 1);
+	b->out_n = 0;
+	for (i = 0; i < b->all_n && b->out; i++)
+		b->out_n += sprintf(b->out + b->out_n, "%s\t%d\t%d\t%ld\n",
+			b->all[i]->user, b->all[i]->best,
+			b->all[i]->tries, b->all[i]->last);
+	b->dirty = 0;
+}
+
+/* load the scoreboards of open contests from their statistics files */
+static void board_load(void)
+{
+	char line[LLEN * 4], user[LLEN], path[LLEN];
+	long date;
+	int c, n;
+	FILE *fp;
+	boards = calloc(conts_n, sizeof(boards[0]));
+	for (c = 0; c < conts_n; c++) {
+		snprintf(path, sizeof(path), "%s.stat", conts[c]);
+		if (!(fp = fopen(path, "r")))
+			continue;
+		while (fgets(line, sizeof(line), fp))
+			if (sscanf(line, "%s %ld %n", user, &date, &n) == 2)
+				board_add(c, user, date, line + n);
+		fclose(fp);
 	}
-	return 1;
 }
 
-/* begin testing a submission */
-static void test_beg(void)
+/* begin testing a submission in judge j */
+static void test_beg(int j)
 {
-	test_idx = subs_first();
-	if (test_idx < 0) {
-		test_pid = 0;
+	struct judge *judge = &judges[j];
+	char res[LLEN];
+	judge->sub = subs_pop();
+	if (!judge->sub) {
+		judge->pid = 0;
 		return;
 	}
-	test_pid = fork();
-	if (!test_pid) {
-		char *argv[5] = {CTTEST, subs[test_idx].cont,
-			subs[test_idx].path, subs[test_idx].lang};
-		close(1);
-		open(CTRESULT, O_WRONLY | O_TRUNC | O_CREAT, 0600);
-		execvp(argv[0], argv);
-		exit(1);
+	judge->sub->tts = util_ms();
+	hist_add(&stat_wait, judge->sub->tts - judge->sub->qts);
+	snprintf(res, sizeof(res), CTRESULT, j);
+	judge->pid = util_judge(CTUID + j, ct_cgroup, judge->sub->cont,
+			judge->sub->path, judge->sub->lang, res);
+	if (judge->pid < 0) {
+		subs_push(judge->sub);
+		judge->sub = NULL;
+		judge->pid = 0;
 	}
 }
 
-/* the termination of the verification program */
-static void sigchild(int sig)
+#define EV_NODE		(1u << 30)	/* epoll data of node connections */
+
+/* connect to judge node n */
+static void node_connect(int n)
 {
-	char line[1 << 10];
+	struct node *node = &nodes[n];
+	struct addrinfo hints, *addr;
+	struct epoll_event ev;
+	int fd;
+	node->seen = util_ms();
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(node->host, node->port, &hints, &addr))
+		return;
+	fd = socket(addr->ai_family, addr->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+			addr->ai_protocol);
+	if (fd >= 0 && connect(fd, addr->ai_addr, addr->ai_addrlen) < 0 &&
+			errno != EINPROGRESS) {
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(addr);
+	if (fd < 0)
+		return;
+	node->conn = conn_make(fd);
+	node->slots = 0;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	ev.data.u32 = EV_NODE + n;
+	epoll_ctl(ct_efd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/* drop the connection to judge node n and queue its programs again */
+static void node_down(int n)
+{
+	struct node *node = &nodes[n];
+	while (node->subs_n > 0)
+		subs_push(node->subs[--node->subs_n]);
+	conn_free(node->conn);
+	node->conn = NULL;
+	node->slots = 0;
+}
+
+/* send a submission to judge node n */
+static void node_send(int n, struct sub *sub)
+{
+	struct node *node = &nodes[n];
+	struct stat st;
+	int fd = open(sub->path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &st) < 0)
+		st.st_size = 0;
+	node->subs[node->subs_n++] = sub;
+	sub->tts = util_ms();
+	hist_add(&stat_wait, sub->tts - sub->qts);
+	conn_printf(node->conn, "job %ld %s %s %ld\n",
+		sub->id, sub->cont, sub->lang, (long) st.st_size);
+	if (fd >= 0 && conn_sendfile(node->conn, fd, st.st_size)) {
+		node_down(n);		/* the header is queued without its body */
+		return;
+	}
+	conn_poll(node->conn, POLLWRNORM);
+}
+
+/* start testing pending submissions in idle judges and nodes */
+static void test_all(void)
+{
+	int i, best, bestfree, free;
+	while (subs_head) {
+		best = -1;			/* local judges */
+		bestfree = 0;
+		for (i = 0; i < judges_n; i++)
+			bestfree += !judges[i].pid;
+		for (i = 0; i < nodes_n && !subs_head->local; i++) {
+			free = nodes[i].slots - nodes[i].subs_n;
+			if (nodes[i].conn && free > bestfree) {
+				best = i;
+				bestfree = free;
+			}
+		}
+		if (!bestfree)
+			break;
+		if (best >= 0) {
+			node_send(best, subs_pop());
+			continue;
+		}
+		for (i = 0; i < judges_n && judges[i].pid; i++)
+			;
+		test_beg(i);
+		if (!judges[i].pid)		/* fork() failed */
+			break;
+	}
+}
+
+/* append the result line of a submission to the given file */
+static void test_log(struct sub *sub, char *ext, char *line)
+{
+	char path[LLEN];
+	FILE *fp;
+	snprintf(path, sizeof(path), "%s.%s", sub->cont, ext);
+	fp = fopen(path, "a");
+	if (fp) {
+		fprintf(fp, "%s\t%ld\t%s", sub->user, sub->date, line);
+		fclose(fp);
+	}
+}
+
+/* record the output of test for a submission; an error if it is empty */
+static void test_done(struct sub *sub, FILE *resfp)
+{
+	char line[LLEN * 32];
+	if (!resfp || !fgets(line, sizeof(line), resfp))
+		snprintf(line, sizeof(line), "-\t-\t# Failed\n");
+	test_log(sub, "stat", line);
+	if (conts_find(sub->cont) >= 0)
+		board_add(conts_find(sub->cont), sub->user, sub->date, line);
+	if (resfp && fgets(line, sizeof(line), resfp)) {
+		test_log(sub, "xstat", line);
+		if (atol(line) > 0)	/* not cached or interpreted */
+			hist_add(&stat_comp, atol(line));
+	}
+	hist_add(&stat_judge, util_ms() - sub->tts);
+	subs_done(sub);
+}
+
+/* the termination of the verification program in judge j */
+static void test_end(int j)
+{
+	struct judge *judge = &judges[j];
 	char path[LLEN];
-	FILE *resfp, *statfp;
-	signal(SIGCHLD, sigchild);
-	if (waitpid(test_pid, NULL, WNOHANG) == test_pid) {
-		resfp = fopen(CTRESULT, "r");
-		if (resfp && fgets(line, sizeof(line), resfp)) {
-			snprintf(path, sizeof(path), "%s.stat",
-					subs[test_idx].cont);
-			statfp = fopen(path, "a");
-			if (statfp) {
-				fprintf(statfp, "%s\t%ld\t%s",
-					subs[test_idx].user,
-					subs[test_idx].date,
-					line);
-				fclose(statfp);
+	FILE *resfp;
+	snprintf(path, sizeof(path), CTRESULT, j);
+	resfp = fopen(path, "r");
+	test_done(judge->sub, resfp);
+	if (resfp)
+		fclose(resfp);
+	judge->sub = NULL;
+	judge->pid = 0;
+}
+
+/* handle the messages of judge node n */
+static void node_recv(int n)
+{
+	struct node *node = &nodes[n];
+	char line[LLEN];
+	long id, len, hdr;
+	void *buf;
+	long buflen;
+	char *eol;
+	int i;
+	while (!conn_recvbuf(node->conn, &buf, &buflen) && buflen > 0) {
+		node->seen = util_ms();
+		if (!(eol = memchr(buf, '\n', MIN(buflen, LLEN)))) {
+			if (buflen >= LLEN)
+				conn_hang(node->conn);
+			return;
+		}
+		hdr = eol + 1 - (char *) buf;
+		memcpy(line, buf, hdr - 1);
+		line[hdr - 1] = '\0';
+		if (sscanf(line, "done %ld %ld", &id, &len) == 2) {
+			FILE *resfp;
+			if (buflen < hdr + len)
+				return;
+			for (i = 0; i < node->subs_n && node->subs[i]->id != id; i++)
+				;
+			if (i < node->subs_n) {
+				struct sub *sub = node->subs[i];
+				node->subs[i] = node->subs[--node->subs_n];
+				resfp = len ? fmemopen(eol + 1, len, "r") : NULL;
+				test_done(sub, resfp);
+				if (resfp)
+					fclose(resfp);
 			}
+			conn_recv(node->conn, NULL, hdr + len);
+			continue;
+		}
+		if (sscanf(line, "fail %ld", &id) == 1) {
+			for (i = 0; i < node->subs_n && node->subs[i]->id != id; i++)
+				;
+			if (i < node->subs_n) {
+				struct sub *sub = node->subs[i];
+				node->subs[i] = node->subs[--node->subs_n];
+				sub->local = 1;
+				if (judges_n > 0)
+					subs_push(sub);
+				else
+					test_done(sub, NULL);
+			}
+		}
+		if (sscanf(line, "hello %d", &i) == 1 && !node->slots && i > 0) {
+			node->subs = realloc(node->subs, i * sizeof(node->subs[0]));
+			node->slots = node->subs ? i : 0;
+		}
+		conn_recv(node->conn, NULL, hdr);
+	}
+}
+
+/* handle the events of the connection to judge node n */
+static void node_serve(int n, int events)
+{
+	struct conn *conn = nodes[n].conn;
+	if (!conn)
+		return;
+	if (conn_poll(conn, events))
+		conn_hang(conn);
+	if (!conn_hung(conn))
+		node_recv(n);
+	if (conn_hung(conn) || !(conn_events(conn) & POLLRDNORM))
+		node_down(n);
+	test_all();
+}
+
+/* connect to judge nodes, send heartbeats and drop silent nodes;
+ * return the milliseconds to the next call */
+static int node_tick(void)
+{
+	static long last;
+	long now = util_ms();
+	int i;
+	if (!nodes_n)
+		return -1;
+	if (now - last < CTPING * 1000)
+		return last + CTPING * 1000 - now;
+	last = now;
+	for (i = 0; i < nodes_n; i++) {
+		struct node *node = &nodes[i];
+		if (node->conn && node->seen + CTNODEDEAD * 1000 < now)
+			node_down(i);
+		if (!node->conn) {
+			node_connect(i);
+		} else {
+			conn_printf(node->conn, "ping\n");
+			conn_poll(node->conn, POLLWRNORM);
 		}
-		if (resfp)
-			fclose(resfp);
-		subs[test_idx].valid = 0;
-		if (subs_first() >= 0)
-			test_beg();
-		else
-			test_pid = 0;
 	}
+	test_all();
+	return CTPING * 1000;
+}
+
+/* collect the results of terminated verification programs */
+static void test_reap(int sfd)
+{
+	int pid, i;
+	while ((pid = util_reap(sfd)) > 0)
+		for (i = 0; i < judges_n; i++)
+			if (judges[i].pid == pid)
+				test_end(i);
+	test_all();
 }
 
-static int ct_register(struct conn *conn, char *req)
+static int ct_register(struct conn *conn, char *req, char *addr)
 {
 	char user[LLEN], pass[LLEN];
 	int gap;
@@ -299,7 +977,7 @@ static int ct_register(struct conn *conn, char *req)
 		conn_printf(conn, "register: user exists!\n");
 		return 1;
 	}
-	if ((gap = ratelimit_register())) {
+	if ((gap = ratelimit_register(addr))) {
 		conn_printf(conn, "register: retry %d seconds later!\n", gap);
 		return 1;
 	}
@@ -310,44 +988,60 @@ static int ct_register(struct conn *conn, char *req)
 
 static int ct_report(struct conn *conn, char *req)
 {
-	char buf[1 << 12];
-	char cont[LLEN];
+	char cont[LLEN], ext[LLEN];
 	char path[LLEN];
-	int statfd, nr, i;
-	if (sscanf(req, "report %s", cont) != 1) {
+	struct stat st;
+	struct sub *sub;
+	int statfd, i, j;
+	int n = sscanf(req, "report %s %s", cont, ext);
+	if (n < 1) {
 		conn_printf(conn, "report: insufficient arguments!\n");
 		return 1;
 	}
-	snprintf(path, sizeof(path), "%s.stat", cont);
-	statfd = open(path, O_RDONLY);
-	if (statfd >= 0) {
-		while ((nr = read(statfd, buf, sizeof(buf))) > 0)
-			if (conn_send(conn, buf, nr))
-				return 1;
+	if (n > 1 && strcmp("x", ext)) {
+		conn_printf(conn, "report: unknown option!\n");
+		return 1;
+	}
+	snprintf(path, sizeof(path), "%s.%s", cont, n > 1 ? "xstat" : "stat");
+	statfd = open(path, O_RDONLY | O_CLOEXEC);
+	if (statfd >= 0 && fstat(statfd, &st) < 0) {
 		close(statfd);
+		return 1;
 	}
-	for (i = 0; i < LEN(subs); i++)
-		if (subs[i].valid && !strcmp(cont, subs[i].cont))
+	if (statfd >= 0 && conn_sendfile(conn, statfd, st.st_size))
+		return 1;
+	for (i = 0; i < judges_n && n == 1; i++)
+		if (judges[i].pid && !strcmp(cont, judges[i].sub->cont))
+			conn_printf(conn, "%s\t%ld\t-\t-\t# Waiting\n",
+				judges[i].sub->user, judges[i].sub->date);
+	for (i = 0; i < nodes_n && n == 1; i++)
+		for (j = 0; j < nodes[i].subs_n; j++)
+			if (!strcmp(cont, nodes[i].subs[j]->cont))
+				conn_printf(conn, "%s\t%ld\t-\t-\t# Waiting\n",
+					nodes[i].subs[j]->user, nodes[i].subs[j]->date);
+	for (sub = subs_head; sub && n == 1; sub = sub->next)
+		if (!strcmp(cont, sub->cont))
 			conn_printf(conn, "%s\t%ld\t-\t-\t# Waiting\n",
-				subs[i].user, subs[i].date);
+				sub->user, sub->date);
 	return 0;
 }
 
-static int isdir(char *path)
-{
-	struct stat st;
-	if (stat(path, &st) < 0)
-		return 0;
-	return S_ISDIR(st.st_mode);
-}
-
-static int conts_find(char *cont)
+static int ct_scoreboard(struct conn *conn, char *req)
 {
-	int i;
-	for (i = 0; i < conts_n; i++)
-		if (!strcmp(cont, conts[i]))
-			return i;
-	return -1;
+	char cont[LLEN];
+	int c;
+	if (sscanf(req, "scoreboard %s", cont) != 1) {
+		conn_printf(conn, "scoreboard: insufficient arguments!\n");
+		return 1;
+	}
+	if ((c = conts_find(cont)) < 0) {
+		conn_printf(conn, "scoreboard: contest is not open!\n");
+		return 1;
+	}
+	board_make(c);
+	if (boards[c].out)
+		conn_send(conn, boards[c].out, boards[c].out_n);
+	return 0;
 }
 
 /* find submit end marker */
@@ -380,162 +1074,421 @@ static int langok(char *lang)
 	return 0;
 }
 
-static int ct_write(int fd, void *buf, int buflen)
+static int ct_write(int fd, void *buf, int buflen, int beg)
 {
 	unsigned char *s = buf;
-	if (buflen >= 3 && s[0] == 0xef && s[1] == 0xbb && s[2] == 0xbf) {
+	if (beg && buflen >= 3 && s[0] == 0xef && s[1] == 0xbb && s[2] == 0xbf) {
 		buf += 3;	/* skip windows BOM */
 		buflen -= 3;
 	}
 	return write(fd, buf, buflen);
 }
 
-static int ct_submit(struct conn *conn, char *req)
+/* check a submission request and open its file; the program follows */
+static int ct_submit(struct conn *conn, char *req, char *path)
 {
 	char user[LLEN], pass[LLEN], cont[LLEN], lang[LLEN];
-	char path[LLEN], end[LLEN];
-	void *buf;
-	long buflen;
 	int gap;
 	int fd;
-	endmarker(req, end);
-	if (conn_ends(conn, end))
-		end[0] = '\0';
 	if (sscanf(req, "submit %s %s %s %s", user, pass, cont, lang) != 4) {
 		conn_printf(conn, "submit: insufficient arguments!\n");
-		return 1;
+		return -1;
 	}
 	if (conts_find(cont) < 0) {
 		conn_printf(conn, "submit: contest is not open!\n");
-		return 1;
+		return -1;
 	}
 	if (!langok(lang)) {
 		conn_printf(conn, "submit: unknown language!\n");
-		return 1;
+		return -1;
 	}
 	if ((gap = ratelimit_submit(user))) {
 		conn_printf(conn, "submit: retry %d seconds later!\n", gap);
-		return 1;
+		return -1;
 	}
 	if (users_login(user, pass)) {
 		conn_printf(conn, "submit: failed to log in!\n");
-		return 1;
+		return -1;
 	}
-	if (subs_find(user, cont) >= 0) {
+	if (subs_find(user, cont) || uploads_add(user, cont)) {
 		conn_printf(conn, "submit: pending submission, wait!\n");
-		return 1;
+		return -1;
 	}
-	if (!isdir(CTLOGS))
+	if (!util_isdir(CTLOGS))
 		mkdir(CTLOGS, 0700);
-	snprintf(path, sizeof(path), "%s/%s-%s.%s", CTLOGS, cont, user, lang);
-	fd = open(path, O_WRONLY | O_TRUNC | O_CREAT, 0600);
+	snprintf(path, LLEN, "%s/%s-%s.%s.tmp", CTLOGS, cont, user, lang);
+	fd = open(path, O_WRONLY | O_TRUNC | O_CREAT | O_CLOEXEC, 0600);
 	if (fd < 0) {
 		conn_printf(conn, "submit: cannot write!\n");
+		uploads_del(user, cont);
+	}
+	return fd;
+}
+
+/* queue the submitted program in path, after receiving all of it */
+static int ct_submitted(struct conn *conn, char *req, char *path)
+{
+	char user[LLEN], pass[LLEN], cont[LLEN], lang[LLEN];
+	char dst[LLEN];
+	sscanf(req, "submit %s %s %s %s", user, pass, cont, lang);
+	uploads_del(user, cont);
+	snprintf(dst, sizeof(dst), "%s/%s-%s.%s", CTLOGS, cont, user, lang);
+	if (rename(path, dst)) {
+		conn_printf(conn, "submit: cannot write!\n");
+		unlink(path);
 		return 1;
 	}
-	conn_recvall(conn, &buf, &buflen);
-	buflen -= strlen(end);
-	ct_write(fd, buf, buflen);
-	free(buf);
-	close(fd);
-	if (!subs_add(user, cont, lang, path))
+	if (!subs_add(user, cont, lang, dst)) {
 		conn_printf(conn, "submit: submission queued.\n");
-	else
+		stat_subs++;
+	} else
 		conn_printf(conn, "submit: many submissions, retry later!\n");
-	if (!test_pid && subs_first() >= 0)
-		test_beg();
+	test_all();
 	return 0;
 }
 
+/* discard an incomplete upload */
+static void ct_unsubmit(char *req, char *path)
+{
+	char user[LLEN], pass[LLEN], cont[LLEN];
+	sscanf(req, "submit %s %s %s", user, pass, cont);
+	uploads_del(user, cont);
+	unlink(path);
+}
+
 static int ct_log(struct conn *conn, char *req)
 {
 	fputs(req, stderr);
 	return 0;
 }
 
-static struct conn *conns[CTCONNS];	/* server connections */
-static int conns_lim[CTCONNS];		/* read until 1:EOL or 2:EOF */
-static int conns_ts[CTCONNS];		/* start timestamp (in seconds) */
-static char conns_req[CTCONNS][LLEN];	/* connection request line */
+/* server connections */
+struct cli {
+	struct conn *conn;		/* connection; NULL for free slots */
+	int lim;			/* read until 1:EOL or 2:EOF */
+	long due;			/* deadline (util_ms()) */
+	int sfd;			/* submission file (if lim is 2) */
+	long slen;			/* bytes received for the submission */
+	char end[LLEN];			/* submission end marker */
+	char path[LLEN];		/* submission file path */
+	char addr[64];			/* peer address */
+	char req[LLEN];			/* connection request line */
+};
+
+static struct cli *clis;		/* server connections */
+static int clis_sz;			/* size of clis[] */
+static int clis_n;			/* number of connections */
+static int *clis_free;			/* free slots of clis[] */
+static int clis_nfree;			/* number of free slots */
+
+/* connection deadlines; a min-heap with stale entries for closed slots */
+struct due {
+	long due;			/* deadline (util_ms()) */
+	int cli;			/* index into clis[] */
+};
+
+static struct due *dues;		/* the heap */
+static int dues_n;			/* number of entries in dues[] */
+static int dues_sz;			/* size of dues[] */
+
+#define EV_LISTEN	(~0u)		/* epoll data of the server socket */
+#define EV_CHILD	(~1u)		/* epoll data of the SIGCHLD signalfd */
+
+/* allocate a slot in clis[] */
+static int clis_add(void)
+{
+	if (!clis_nfree) {
+		int sz = clis_sz ? clis_sz * 2 : 64;
+		struct cli *new = realloc(clis, sz * sizeof(clis[0]));
+		int *free;
+		if (!new)
+			return -1;
+		clis = new;
+		if (!(free = realloc(clis_free, sz * sizeof(clis_free[0]))))
+			return -1;
+		clis_free = free;
+		memset(clis + clis_sz, 0, (sz - clis_sz) * sizeof(clis[0]));
+		while (clis_sz < sz)
+			clis_free[clis_nfree++] = --sz;
+		clis_sz += clis_nfree;
+	}
+	clis_n++;
+	return clis_free[--clis_nfree];
+}
+
+/* close the connection in slot i */
+static void clis_del(int i)
+{
+	if (clis[i].lim == 2) {
+		close(clis[i].sfd);
+		ct_unsubmit(clis[i].req, clis[i].path);
+	}
+	conn_free(clis[i].conn);
+	clis[i].conn = NULL;
+	clis_free[clis_nfree++] = i;
+	clis_n--;
+}
+
+static void dues_swap(int i, int j)
+{
+	struct due t = dues[i];
+	dues[i] = dues[j];
+	dues[j] = t;
+}
+
+/* insert the deadline of connection i; return nonzero on failure */
+static int dues_push(int i)
+{
+	int n = dues_n;
+	if (dues_n == dues_sz) {
+		int sz = dues_sz ? dues_sz * 2 : 64;
+		struct due *new = realloc(dues, sz * sizeof(dues[0]));
+		if (!new)
+			return 1;
+		dues = new;
+		dues_sz = sz;
+	}
+	dues[n].due = clis[i].due;
+	dues[n].cli = i;
+	dues_n++;
+	for (; n > 0 && dues[(n - 1) / 2].due > dues[n].due; n = (n - 1) / 2)
+		dues_swap(n, (n - 1) / 2);
+	return 0;
+}
+
+/* remove the nearest deadline */
+static void dues_pop(void)
+{
+	int i = 0, j;
+	dues[0] = dues[--dues_n];
+	while ((j = i * 2 + 1) < dues_n) {
+		if (j + 1 < dues_n && dues[j + 1].due < dues[j].due)
+			j++;
+		if (dues[i].due <= dues[j].due)
+			break;
+		dues_swap(i, j);
+		i = j;
+	}
+}
+
+/* kill slow connections; return the milliseconds to the next deadline */
+static int dues_expire(void)
+{
+	long now = util_ms();
+	while (dues_n && dues[0].due <= now) {
+		int i = dues[0].cli;
+		if (clis[i].conn && clis[i].due == dues[0].due) {
+			clis_del(i);
+			stat_timeouts++;
+		}
+		dues_pop();
+	}
+	return dues_n ? dues[0].due - now : -1;
+}
 
-static int ct_poll(int fd)
+/* accept incoming connections */
+static void ct_accept(int fd)
 {
-	struct pollfd fds[CTCONNS + 1];
-	char end[LLEN], cmd[LLEN];
-	int cfd;
-	int i;
-	for (i = 0; i < CTCONNS; i++)		/* kill slow connections */
-		if (conns[i] && conns_ts[i] + CTTIMEOUT < time(NULL))
-			conn_hang(conns[i]);
-	for (i = 0; i < CTCONNS; i++) {		/* initialize fds[] */
-		if (!conns[i] || conn_hung(conns[i])) {
-			fds[i].fd = -1;
-			fds[i].events = 0;
-		} else {
-			fds[i].fd = conn_fd(conns[i]);
-			fds[i].events = conn_events(conns[i]);
+	struct epoll_event ev;
+	struct sockaddr_in sa;
+	socklen_t salen = sizeof(sa);
+	int cfd, i;
+	while (1) {
+		cfd = accept(fd, (void *) &sa, &salen);
+		if (cfd < 0 && (errno == EMFILE || errno == ENFILE) && ct_spare >= 0) {
+			close(ct_spare);	/* drop it; the listener is edge-triggered */
+			if ((cfd = accept(fd, NULL, NULL)) >= 0)
+				close(cfd);
+			ct_spare = open("/dev/null", O_RDONLY | O_CLOEXEC);
+			stat_rejects++;
+			if (cfd >= 0)
+				continue;
+		}
+		if (cfd < 0 && (errno == EINTR || errno == ECONNABORTED))
+			continue;
+		if (cfd < 0)
+			break;
+		fcntl(cfd, F_SETFD, fcntl(cfd, F_GETFD) | FD_CLOEXEC);
+		fcntl(cfd, F_SETFL, fcntl(cfd, F_GETFL) | O_NONBLOCK);
+		if (clis_n >= ct_conns || (i = clis_add()) < 0) {
+			stat_rejects++;
+			close(cfd);
+			continue;
+		}
+		clis[i].conn = conn_make(cfd);
+		clis[i].lim = 1;
+		clis[i].due = util_ms() + CTTIMEOUT * 1000;
+		if (dues_push(i)) {	/* it would never time out */
+			stat_rejects++;
+			clis_del(i);
+			continue;
 		}
+		inet_ntop(AF_INET, &sa.sin_addr, clis[i].addr, sizeof(clis[i].addr));
+		salen = sizeof(sa);
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		ev.data.u32 = i;
+		if (epoll_ctl(ct_efd, EPOLL_CTL_ADD, cfd, &ev))
+			clis_del(i);
+	}
+}
+
+/* write the received part of a submission, except a possible end marker */
+static int ct_ingest(struct cli *cli)
+{
+	long elen = strlen(cli->end);
+	int done = !(conn_events(cli->conn) & POLLRDNORM);	/* EOF */
+	void *buf;
+	long len, n;
+	if (conn_recvbuf(cli->conn, &buf, &len))
+		len = 0;
+	if (len >= elen && !memcmp(buf + len - elen, cli->end, elen)) {
+		len -= elen;
+		done = 1;
 	}
-	fds[CTCONNS].fd = fd;
-	fds[CTCONNS].events = POLLRDNORM | POLLHUP | POLLERR | POLLNVAL;
-	if (poll(fds, CTCONNS + 1, 1000) < 0)
+	if (cli->slen + len > CTSUBSZ)
+		return -1;
+	if (!done && !cli->slen && len < 3)	/* wait for a possible BOM */
 		return 0;
-	for (i = 0; i < CTCONNS; i++) {		/* check connection events */
-		if (fds[i].revents) {
-			if (conn_poll(conns[i], fds[i].revents))
-				conn_hang(conns[i]);
-			if (conns_lim[i] == 1 && conn_eol(conns[i]) >= 0) {
-				conn_recveol(conns[i], conns_req[i], sizeof(conns_req[i]));
-				ct_log(conns[i], conns_req[i]);
-				sscanf(conns_req[i], "%s", cmd);
-				conns_lim[i] = 0;
-				if (!strcmp("register", cmd)) {
-					ct_register(conns[i], conns_req[i]);
-				} else if (!strcmp("report", cmd)) {
-					ct_report(conns[i], conns_req[i]);
-				} else if (!strcmp("submit", cmd)) {
-					conns_lim[i] = 2;
-				} else {
-					conn_hang(conns[i]);
-				}
-			}
-			if (conns_lim[i] == 2) {
-				endmarker(conns_req[i], end);
-				if (conn_hung(conns[i]) || !conn_ends(conns[i], end)) {
-					ct_submit(conns[i], conns_req[i]);
-					conns_lim[i] = 0;
-				}
-				if (conn_len(conns[i]) > CTSUBSZ)
-					conn_hang(conns[i]);
-			}
-			if (conns_lim[i] == 0 && !(conn_events(conns[i]) & POLLWRNORM))
-				conn_hang(conns[i]);
+	n = done ? len : len - elen + 1;
+	if (n > 0) {
+		if (ct_write(cli->sfd, buf, n, !cli->slen) < 0)
+			return -1;
+		conn_recv(cli->conn, NULL, n);
+		cli->slen += n;
+	}
+	return done;
+}
+
+static void stats_hist(struct conn *conn, char *name, struct hist *h)
+{
+	conn_printf(conn, "%s\t%ld\t%ld\t%ld\t%ld\t%ld\t%ld\n", name, h->n,
+		h->n ? h->sum / h->n : 0, hist_pct(h, 50), hist_pct(h, 90),
+		hist_pct(h, 99), h->max);
+}
+
+static int ct_stats(struct conn *conn, char *addr)
+{
+	long sent, recvd;
+	int busy = 0, up = 0, slots = 0, remote = 0;
+	int i;
+	if (strcmp(addr, "127.0.0.1")) {
+		conn_printf(conn, "stats: only for local clients!\n");
+		return 1;
+	}
+	for (i = 0; i < judges_n; i++)
+		busy += judges[i].pid != 0;
+	for (i = 0; i < nodes_n; i++) {
+		up += nodes[i].conn != NULL;
+		slots += nodes[i].slots;
+		remote += nodes[i].subs_n;
+	}
+	conn_stats(&sent, &recvd);
+	conn_printf(conn, "queue\t%d\n", subs_n - busy - remote);
+	conn_printf(conn, "judges\t%d\t%d\n", busy, judges_n);
+	conn_printf(conn, "nodes\t%d\t%d\t%d\t%d\n", up, nodes_n, remote, slots);
+	conn_printf(conn, "conns\t%d\t%d\n", clis_n, ct_conns);
+	conn_printf(conn, "requests\t%ld\n", stat_reqs);
+	conn_printf(conn, "submissions\t%ld\n", stat_subs);
+	conn_printf(conn, "rejected\t%ld\n", stat_rejects);
+	conn_printf(conn, "timeouts\t%ld\n", stat_timeouts);
+	conn_printf(conn, "sent\t%ld\n", sent);
+	conn_printf(conn, "received\t%ld\n", recvd);
+	stats_hist(conn, "wait", &stat_wait);
+	stats_hist(conn, "judge", &stat_judge);
+	stats_hist(conn, "compile", &stat_comp);
+	return 0;
+}
+
+/* handle the events of connection i */
+static void ct_serve(int i, int events)
+{
+	struct cli *cli = &clis[i];
+	char cmd[LLEN];
+	int done;
+	if (conn_poll(cli->conn, events))
+		conn_hang(cli->conn);
+	if (cli->lim == 1 && conn_eol(cli->conn) >= 0) {
+		conn_recveol(cli->conn, cli->req, sizeof(cli->req));
+		ct_log(cli->conn, cli->req);
+		sscanf(cli->req, "%s", cmd);
+		cli->lim = 0;
+		stat_reqs++;
+		if (!strcmp("register", cmd)) {
+			ct_register(cli->conn, cli->req, cli->addr);
+		} else if (!strcmp("report", cmd)) {
+			ct_report(cli->conn, cli->req);
+		} else if (!strcmp("scoreboard", cmd)) {
+			ct_scoreboard(cli->conn, cli->req);
+		} else if (!strcmp("stats", cmd)) {
+			ct_stats(cli->conn, cli->addr);
+		} else if (!strcmp("submit", cmd)) {
+			cli->sfd = ct_submit(cli->conn, cli->req, cli->path);
+			endmarker(cli->req, cli->end);
+			cli->slen = 0;
+			cli->lim = 2;
+			if (cli->sfd < 0)	/* rejected; the program is not read */
+				cli->lim = 0;
+		} else {
+			conn_hang(cli->conn);
 		}
 	}
-	for (i = 0; i < CTCONNS; i++) {		/* remove dead connections */
-		if (conns[i] && conn_hung(conns[i])) {
-			conn_free(conns[i]);
-			conns[i] = NULL;
+	if (cli->lim == 2 && (done = ct_ingest(cli))) {
+		close(cli->sfd);
+		cli->lim = 0;
+		if (done < 0) {
+			ct_unsubmit(cli->req, cli->path);
+			conn_hang(cli->conn);
+		} else {
+			ct_submitted(cli->conn, cli->req, cli->path);
 		}
 	}
-	if (fds[CTCONNS].revents & POLLRDNORM) {
-		for (i = 0; i < CTCONNS; i++)
-			if (!conns[i])
-				break;
-		if ((cfd = accept(fd, NULL, NULL)) >= 0) {
-			fcntl(cfd, F_SETFD, fcntl(cfd, F_GETFD) | FD_CLOEXEC);
-			fcntl(cfd, F_SETFL, fcntl(cfd, F_GETFL) | O_NONBLOCK);
-			if (i < CTCONNS) {
-				conns[i] = conn_make(cfd);
-				conns_lim[i] = 1;
-				conns_ts[i] = time(NULL);
-			} else {
-				close(cfd);
-			}
+	if (conn_events(cli->conn) & POLLWRNORM)	/* write without waiting */
+		if (conn_poll(cli->conn, POLLWRNORM))
+			conn_hang(cli->conn);
+	if (cli->lim == 0 && !(conn_events(cli->conn) & POLLWRNORM))
+		conn_hang(cli->conn);
+	if (conn_hung(cli->conn))
+		clis_del(i);
+}
+
+static int ct_poll(int fd, int sfd)
+{
+	struct epoll_event evs[CTEVENTS];
+	int due = dues_expire();
+	int tick = node_tick();
+	int n, i;
+	if (due < 0 || (tick >= 0 && tick < due))
+		due = tick;
+	subs_sync();
+	if ((n = epoll_wait(ct_efd, evs, LEN(evs), due)) < 0)
+		return 0;
+	for (i = 0; i < n; i++) {
+		int ev = evs[i].events;
+		if (evs[i].data.u32 == EV_LISTEN) {
+			if (ev & (EPOLLHUP | EPOLLERR))
+				return 1;
+			ct_accept(fd);
+			continue;
 		}
+		if (evs[i].data.u32 == EV_CHILD) {
+			test_reap(sfd);
+			continue;
+		}
+		if (evs[i].data.u32 >= EV_NODE && evs[i].data.u32 < EV_NODE + nodes_n) {
+			node_serve(evs[i].data.u32 - EV_NODE,
+				(ev & EPOLLIN ? POLLRDNORM : 0) |
+				(ev & EPOLLOUT ? POLLWRNORM : 0) |
+				(ev & (EPOLLHUP | EPOLLERR) ? POLLHUP : 0));
+			continue;
+		}
+		if (!clis[evs[i].data.u32].conn)
+			continue;
+		ct_serve(evs[i].data.u32,
+			(ev & EPOLLIN ? POLLRDNORM : 0) |
+			(ev & EPOLLOUT ? POLLWRNORM : 0) |
+			(ev & (EPOLLHUP | EPOLLERR) ? POLLHUP : 0));
 	}
-	if (fds[CTCONNS].revents & (POLLHUP | POLLERR | POLLNVAL))
-		return 1;
 	return 0;
 }
 
@@ -544,14 +1497,22 @@ static void printusage(char *prog)
 	printf("Usage: %s [options] cont1 ... contn\n\n", prog);
 	printf("Options:\n");
 	printf("  -p port \t set server port number (%s)\n", CTPORT);
-	printf("  -s n    \t minimum gap between submissions (%d)\n", ct_subgap);
-	printf("  -r n    \t minimum gap between registerations (%d)\n", ct_reggap);
+	printf("  -s n    \t minimum gap between submissions of a user (%d)\n", ct_subgap);
+	printf("  -r n    \t minimum gap between registerations of an address (%d)\n", ct_reggap);
+	printf("  -S n    \t submissions allowed without a gap (%d)\n", ct_subburst);
+	printf("  -R n    \t registerations allowed without a gap (%d)\n", ct_regburst);
+	printf("  -j n    \t number of judge workers (processor count)\n");
+	printf("  -g dir  \t cgroup v2 directory for test programs\n");
+	printf("  -c n    \t maximum simultaneous connections (%d)\n", ct_conns);
+	printf("  -w h:p  \t judge node address (may be repeated)\n");
 }
 
 int main(int argc, char *argv[])
 {
 	char *port = CTPORT;
-	int ifd;
+	struct epoll_event ev;
+	sigset_t mask;
+	int ifd, sfd;
 	int i;
 	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
 		if (argv[i][1] == 'p')
@@ -560,6 +1521,27 @@ int main(int argc, char *argv[])
 			ct_reggap = atoi(argv[i][2] ? argv[i] + 2 : argv[++i]);
 		if (argv[i][1] == 's')
 			ct_subgap = atoi(argv[i][2] ? argv[i] + 2 : argv[++i]);
+		if (argv[i][1] == 'R')
+			ct_regburst = atoi(argv[i][2] ? argv[i] + 2 : argv[++i]);
+		if (argv[i][1] == 'S')
+			ct_subburst = atoi(argv[i][2] ? argv[i] + 2 : argv[++i]);
+		if (argv[i][1] == 'j')
+			judges_n = atoi(argv[i][2] ? argv[i] + 2 : argv[++i]);
+		if (argv[i][1] == 'g')
+			ct_cgroup = argv[i][2] ? argv[i] + 2 : argv[++i];
+		if (argv[i][1] == 'c')
+			ct_conns = atoi(argv[i][2] ? argv[i] + 2 : argv[++i]);
+		if (argv[i][1] == 'w') {
+			char *addr = argv[i][2] ? argv[i] + 2 : argv[++i];
+			struct node *node;
+			nodes = realloc(nodes, (nodes_n + 1) * sizeof(nodes[0]));
+			node = &nodes[nodes_n++];
+			memset(node, 0, sizeof(*node));
+			if (sscanf(addr, "%255[^:]:%255s", node->host, node->port) != 2) {
+				fprintf(stderr, "serv: bad node address %s\n", addr);
+				return 1;
+			}
+		}
 		if (argv[i][1] == 'h') {
 			printusage(argv[0]);
 			return 0;
@@ -567,25 +1549,42 @@ int main(int argc, char *argv[])
 	}
 	conts = argv + i;
 	conts_n = argc - i;
+	if (judges_n < 0 || (!judges_n && !nodes_n))
+		judges_n = sysconf(_SC_NPROCESSORS_ONLN);
+	if (judges_n < 0 || (!judges_n && !nodes_n))
+		judges_n = 1;
+	judges = calloc(judges_n, sizeof(judges[0]));
+	board_load();
+	subs_load();
+	signal(SIGPIPE, SIG_IGN);
+	sigemptyset(&mask);		/* SIGCHLD is delivered via sfd */
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+	sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	ct_spare = open("/dev/null", O_RDONLY | O_CLOEXEC);
 	ifd = util_mksocket(NULL, port);
-	signal(SIGCHLD, sigchild);
-	while (!ct_poll(ifd))
+	ct_efd = epoll_create1(EPOLL_CLOEXEC);
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLET;
+	ev.data.u32 = EV_LISTEN;
+	if (ifd < 0 || ct_efd < 0 || epoll_ctl(ct_efd, EPOLL_CTL_ADD, ifd, &ev)) {
+		fprintf(stderr, "serv: cannot listen on port %s\n", port);
+		return 1;
+	}
+	ev.events = EPOLLIN;
+	ev.data.u32 = EV_CHILD;
+	if (sfd < 0 || epoll_ctl(ct_efd, EPOLL_CTL_ADD, sfd, &ev)) {
+		fprintf(stderr, "serv: cannot watch child processes\n");
+		return 1;
+	}
+	test_all();
+	while (!ct_poll(ifd, sfd))
 		;
 	close(ifd);
 	return 0;
 }
 
 /* conn struct extensions */
-static void conn_printf(struct conn *conn, char *fmt, ...)
-{
-	va_list ap;
-	char buf[LLEN * 2];
-	va_start(ap, fmt);
-	vsnprintf(buf, sizeof(buf), fmt, ap);
-	va_end(ap);
-	conn_send(conn, buf, strlen(buf));
-}
-
 static int conn_eol(struct conn *conn)
 {
 	void *r, *eol;
@@ -605,16 +1604,3 @@ static int conn_recveol(struct conn *conn, char *buf, int len)
 	buf[eol] = '\0';
 	return 0;
 }
-
-/* check if the connection ends with the given string */
-static int conn_ends(struct conn *conn, char *s)
-{
-	void *r;
-	long slen = strlen(s);
-	long rlen;
-	if (conn_recvbuf(conn, &r, &rlen))
-		return 1;
-	if (rlen < slen)
-		return 1;
-	return memcmp(s, r + rlen - slen, slen) != 0;
-}
@@ -1,51 +1,135 @@
 /* Challenging Thursdays Judge */
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/resource.h>
 #include <sys/stat.h>
-#include <sys/time.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 #define TESTUID		12345
 #define TESTGID		12345
 #define TIMEOUT		2000		/* process timeout in milliseconds */
-#define WAITDELAY	5		/* delay after each waitpid() in milliseconds */
+#define WALLMUL		2		/* wall-clock timeout multiplier */
+#define LIMITS		"limits"	/* limits file in contest directories */
+#define WAITDELAY	5		/* delay after each wait4() without pidfds */
 #define LLEN		256
 #define MAXMEM		(512l << 20)	/* memory limit */
 #define MAXPROC		(48)		/* process count limit */
 #define MAXFILE		(12)		/* file count limit */
 #define MAXFILESIZE	(1l << 22)	/* file size limit */
+#define LOGS		"logs"		/* submitted programs (for -R) */
 
 #define LEN(a)		((sizeof(a)) / sizeof((a)[0]))
 
+static int test_uid = TESTUID;	/* sandbox user */
+static int test_gid = TESTGID;	/* sandbox group */
+static int test_jobs = 1;	/* number of test cases to run at once */
+static long test_boot;		/* interpreter startup time in milliseconds */
+static int test_tmul = 1;	/* time limit multiplier of the language */
+static int test_wmul = WALLMUL;	/* wall-clock timeout multiplier */
+static char *test_cache;	/* compilation cache directory */
+static int cache_hits;		/* compilation cache hits */
+static int cache_miss;		/* compilation cache misses */
+static int test_ext;		/* print per test case statistics */
+static char *test_cgroup;	/* cgroup v2 directory for programs */
+
+/* test case limits */
+struct lim {
+	long time;		/* timeout in milliseconds */
+	long mem;		/* memory limit */
+	long fsize;		/* file size limit */
+	long proc;		/* process count limit */
+	int cmp;		/* output comparison mode; see util_cmpbuf() */
+	double eps;		/* maximum error of floating point numbers */
+};
+
+static struct lim test_lim = {TIMEOUT, MAXMEM, MAXFILESIZE, MAXPROC, 'e', 1e-6};
+
+/* test case results */
+struct res {
+	int cmt;		/* test case verdict */
+	int score;		/* test case score */
+	long ms;		/* processor time in milliseconds */
+	long kb;		/* maximum resident set size in kilobytes */
+	int sig;		/* terminating signal */
+};
+
+/* contest test cases; loaded once by ct_load() */
+static struct tcase {
+	int ifd;		/* program input */
+	char *exp;		/* expected output (mapped) */
+	long exp_n;		/* length of exp */
+	int vrf;		/* use the verifier program instead of exp */
+	struct lim lim;		/* test case limits */
+} test_cases[100];
+static int test_n;		/* number of test cases */
+static char test_data[LLEN];	/* verifier inputs and programs of test_cases */
+
 /* supported languages */
 static struct lang {
 	char *name;		/* language name */
 	char *file;		/* source file name */
 	char *exec;		/* executable file name */
-	char *intr[16];		/* interpreter arguments (SRC=source) */
+	char *intr[16];		/* interpreter arguments (SRC=source, DIR=its directory) */
 	char *comp[16];		/* compiler arguments (OUT=output, SRC=source) */
+	char *boot[16];		/* interpreter startup; its time is not counted */
+	int tmul;		/* time limit multiplier; see lang_read() */
 } langs[] = {
-	{"sh", "s.sh", ".x", {"bash", "SRC"}},
-	{"py", "s.py", ".x", {"python", "SRC"}},
-	{"py2", "s.py", ".x", {"python2", "SRC"}},
-	{"py3", "s.py", ".x", {"python3", "SRC"}},
-	{"c", "s.c", ".x", {NULL}, {"cc", "-O2", "-pthread", "-o", "OUT", "SRC", "-lm"}},
-	{"c++", "s.c++", ".x", {NULL}, {"c++", "-O2", "-std=c++11", "-pthread", "-o", "OUT", "SRC", "-lm"}},
-	{"java", "Main.java", "Main.class", {"java", "-Xms64m", "-Xmx512m", "Main"}, {"javac", "SRC"}},
-	{"elf", "out", ".x"},
+	{"sh", "s.sh", ".x", {"bash", "SRC"}, {NULL}, {NULL}, 1},
+	{"py", "s.py", ".x", {"python", "SRC"}, {NULL}, {"python", "-c", "pass"}, 1},
+	{"py2", "s.py", ".x", {"python2", "SRC"}, {NULL}, {"python2", "-c", "pass"}, 1},
+	{"py3", "s.py", ".x", {"python3", "SRC"}, {NULL}, {"python3", "-c", "pass"}, 1},
+	{"c", "s.c", ".x", {NULL}, {"cc", "-O2", "-pthread", "-o", "OUT", "SRC", "-lm"}, {NULL}, 1},
+	{"c++", "s.c++", ".x", {NULL}, {"c++", "-O2", "-std=c++11", "-pthread", "-o", "OUT", "SRC", "-lm"}, {NULL}, 1},
+	{"java", "Main.java", "Main.class", {"java", "-Xms64m", "-Xmx512m", "-cp", "DIR", "Main"}, {"javac", "SRC"},
+		{"java", "-Xms64m", "-Xmx512m", "-version"}, 1},
+	{"elf", "out", ".x", {NULL}, {NULL}, {NULL}, 1},
 };
 
 /* current time stamp in milliseconds */
 static long util_ts(void)
 {
-	struct timeval tv;
-	gettimeofday(&tv, NULL);
-	return tv.tv_sec * 1000 + tv.tv_usec / 1000;
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* user and system time in milliseconds */
+static long util_cpu(struct rusage *ru)
+{
+	return (ru->ru_utime.tv_sec + ru->ru_stime.tv_sec) * 1000 +
+		(ru->ru_utime.tv_usec + ru->ru_stime.tv_usec) / 1000;
+}
+
+/* wait at most ms milliseconds for pid to exit; return pid if it did */
+static int util_wait(int pid, int *st, struct rusage *ru, long ms)
+{
+	long beg = util_ts();
+	int ret = -1;
+#ifdef SYS_pidfd_open
+	int fd = syscall(SYS_pidfd_open, pid, 0);
+	if (fd >= 0) {
+		struct pollfd pfd = {fd, POLLIN};
+		long left = ms;
+		while (left > 0 && poll(&pfd, 1, left) < 0 && errno == EINTR)
+			left = ms - (util_ts() - beg);
+		close(fd);
+		return wait4(pid, st, WNOHANG, ru);
+	}
+#endif
+	while ((ret = wait4(pid, st, WNOHANG, ru)) != pid && util_ts() - beg < ms)
+		usleep(WAITDELAY * 1000);
+	return ret;
 }
 
 /* return nonzero for regular files */
@@ -66,30 +150,129 @@ static int util_isdir(char *path)
 	return S_ISDIR(st.st_mode);
 }
 
-/* return zero if the given files match */
-static int util_cmp(char *path1, char *path2)
-{
-	char l1[1024], l2[1024];
-	FILE *f1, *f2;
-	int equal = 1;
-	f1 = fopen(path1, "r");
-	f2 = fopen(path2, "r");
-	if (!f1 || !f2)
-		equal = 0;
-	while (equal) {
-		char *r1 = fgets(l1, sizeof(l1), f1);
-		char *r2 = fgets(l2, sizeof(l2), f2);
-		if (!r1 || !r2) {
-			equal = !r1 && !r2;
-			break;
-		}
-		equal = !strcmp(l1, l2);
+/* open a stream for reading fd from the beginning */
+static FILE *util_fdopen(int fd)
+{
+	FILE *fp;
+	if (fd < 0 || lseek(fd, 0, SEEK_SET) != 0 || (fd = dup(fd)) < 0)
+		return NULL;
+	if (!(fp = fdopen(fd, "r")))
+		close(fd);
+	return fp;
+}
+
+/* map the file into memory */
+static char *util_map(int fd, long *len)
+{
+	struct stat st;
+	char *buf;
+	*len = 0;
+	if (fd < 0 || fstat(fd, &st) < 0)
+		return NULL;
+	if (st.st_size == 0)
+		return "";
+	buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (buf == MAP_FAILED)
+		return NULL;
+	*len = st.st_size;
+	return buf;
+}
+
+/* return zero if lines match, ignoring trailing whitespace and empty lines */
+static int cmp_lines(char *s1, char *e1, char *s2, char *e2)
+{
+	while (s1 < e1 || s2 < e2) {
+		char *l1 = memchr(s1, '\n', e1 - s1);
+		char *l2 = memchr(s2, '\n', e2 - s2);
+		char *t1 = l1 ? l1 : e1;
+		char *t2 = l2 ? l2 : e2;
+		while (t1 > s1 && isspace((unsigned char) t1[-1]))
+			t1--;
+		while (t2 > s2 && isspace((unsigned char) t2[-1]))
+			t2--;
+		if (t1 - s1 != t2 - s2 || memcmp(s1, s2, t1 - s1))
+			return 1;
+		s1 = l1 ? l1 + 1 : e1;
+		s2 = l2 ? l2 + 1 : e2;
+	}
+	return 0;
+}
+
+/* return zero if the two tokens are numbers within eps of each other (s1 is expected) */
+static int cmp_float(char *s1, long n1, char *s2, long n2, double eps)
+{
+	char b1[64], b2[64];
+	char *r1, *r2;
+	double d1, d2, d;
+	if (n1 >= sizeof(b1) || n2 >= sizeof(b2))
+		return 1;
+	memcpy(b1, s1, n1);
+	memcpy(b2, s2, n2);
+	b1[n1] = '\0';
+	b2[n2] = '\0';
+	d1 = strtod(b1, &r1);
+	d2 = strtod(b2, &r2);
+	if (*r1 || *r2 || r1 == b1 || r2 == b2)
+		return 1;
+	d = d1 > d2 ? d1 - d2 : d2 - d1;
+	return !(d <= eps || d <= eps * (d1 < 0 ? -d1 : d1));
+}
+
+/* return zero if whitespace separated tokens match */
+static int cmp_tokens(char *s1, char *e1, char *s2, char *e2, int num, double eps)
+{
+	while (1) {
+		char *t1, *t2;
+		while (s1 < e1 && isspace((unsigned char) *s1))
+			s1++;
+		while (s2 < e2 && isspace((unsigned char) *s2))
+			s2++;
+		if (s1 == e1 || s2 == e2)
+			return s1 != e1 || s2 != e2;
+		for (t1 = s1; t1 < e1 && !isspace((unsigned char) *t1); t1++)
+			;
+		for (t2 = s2; t2 < e2 && !isspace((unsigned char) *t2); t2++)
+			;
+		if (t1 - s1 != t2 - s2 || memcmp(s1, s2, t1 - s1))
+			if (!num || cmp_float(s1, t1 - s1, s2, t2 - s2, eps))
+				return 1;
+		s1 = t1;
+		s2 = t2;
 	}
-	if (f1)
-		fclose(f1);
-	if (f2)
-		fclose(f2);
-	return !equal;
+}
+
+/*
+ * return zero if s1 matches the given file; mode can be:
+ * e: exact match
+ * w: ignore trailing whitespace and trailing empty lines
+ * t: compare whitespace separated tokens
+ * f: like t, but numbers may differ by eps (absolute or relative)
+ */
+static int util_cmpbuf(char *s1, long n1, int fd2, int mode, double eps)
+{
+	long n2;
+	char *s2 = util_map(fd2, &n2);
+	int ret = 1;
+	if (s1 && s2 && mode == 'e')
+		ret = n1 != n2 || memcmp(s1, s2, n1);
+	if (s1 && s2 && mode == 'w')
+		ret = cmp_lines(s1, s1 + n1, s2, s2 + n2);
+	if (s1 && s2 && (mode == 't' || mode == 'f'))
+		ret = cmp_tokens(s1, s1 + n1, s2, s2 + n2, mode == 'f', eps);
+	if (s2 && n2)
+		munmap(s2, n2);
+	return ret;
+}
+
+/* return zero if the given files match; see util_cmpbuf() */
+static int util_cmp(int fd1, int fd2, int mode, double eps)
+{
+	long n1;
+	char *s1 = util_map(fd1, &n1);
+	int ret = util_cmpbuf(s1, n1, fd2, mode, eps);
+	if (s1 && n1)
+		munmap(s1, n1);
+	return ret;
 }
 
 /* copy spath into dpath */
@@ -143,6 +326,26 @@ static char **lang_comp(char *lang)
 	return NULL;
 }
 
+/* return interpreter startup arguments for the given language */
+static char **lang_boot(char *lang)
+{
+	int i;
+	for (i = 0; i < LEN(langs); i++)
+		if (!strcmp(langs[i].name, lang))
+			return langs[i].boot[0] ? langs[i].boot : NULL;
+	return NULL;
+}
+
+/* return time limit multiplier for the given language */
+static int lang_tmul(char *lang)
+{
+	int i;
+	for (i = 0; i < LEN(langs); i++)
+		if (!strcmp(langs[i].name, lang))
+			return langs[i].tmul;
+	return 1;
+}
+
 /* return source file name for the given language */
 static char *lang_file(char *lang)
 {
@@ -163,14 +366,14 @@ static char *lang_exec(char *lang)
 	return NULL;
 }
 
-/* kill all processes owned by TESTUID */
+/* kill all processes owned by test_uid */
 static void util_slaughter(void)
 {
 	int i;
 	for (i = 0; i < 3; i++) {
 		int pid = fork();
 		if (!pid) {
-			if (setgid(TESTGID) || setuid(TESTUID))
+			if (setgid(test_gid) || setuid(test_uid))
 				exit(1);
 			kill(-1, SIGKILL);
 			exit(0);
@@ -180,71 +383,169 @@ static void util_slaughter(void)
 	}
 }
 
-/* execute epath, with ipath as stdin and opath as stdout; return zero on success */
-static int ct_exec(char **argv, char *tdir, char *ipath, char *opath, char *epath)
+/* write val to the given file of a cgroup */
+static int cg_write(char *cg, char *file, char *val)
+{
+	char path[LLEN];
+	int fd, ret;
+	snprintf(path, sizeof(path), "%s/%s", cg, file);
+	if ((fd = open(path, O_WRONLY | O_CLOEXEC)) < 0)
+		return 1;
+	ret = write(fd, val, strlen(val)) != strlen(val);
+	close(fd);
+	return ret;
+}
+
+/* read the number after key (or the first number if NULL) in a cgroup file */
+static long cg_read(char *cg, char *file, char *key)
+{
+	char path[LLEN], buf[1 << 12];
+	char *s = buf;
+	int fd, nr;
+	snprintf(path, sizeof(path), "%s/%s", cg, file);
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		return -1;
+	nr = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (nr <= 0)
+		return -1;
+	buf[nr] = '\0';
+	while (key && s && (strncmp(s, key, strlen(key)) || s[strlen(key)] != ' '))
+		if ((s = strchr(s, '\n')))
+			s++;
+	return s ? atol(key ? s + strlen(key) : s) : -1;
+}
+
+/* create a cgroup for running a program; return nonzero on failure */
+static int cg_make(char *cg, int len, struct lim *lim, int *mem)
+{
+	static int cnt;
+	char val[64];
+	if (!test_cgroup)
+		return 1;
+	snprintf(cg, len, "%s/ct%d-%d", test_cgroup, getpid(), cnt++);
+	if (mkdir(cg, 0700))
+		return 1;
+	snprintf(val, sizeof(val), "%ld", lim->mem);
+	*mem = !cg_write(cg, "memory.max", val);
+	cg_write(cg, "memory.swap.max", "0");
+	snprintf(val, sizeof(val), "%ld", lim->proc);
+	cg_write(cg, "pids.max", val);
+	cg_write(cg, "cpu.max", "100000 100000");
+	return 0;
+}
+
+/* kill the processes of a cgroup and remove it */
+static void cg_free(char *cg)
+{
+	int i;
+	cg_write(cg, "cgroup.kill", "1");
+	for (i = 0; i < 1000 && rmdir(cg) && errno == EBUSY; i++)
+		usleep(1000);
+}
+
+/* execute argv in dir, with ifd as stdin and ofd as stdout; return zero on success */
+static int ct_exec(char **argv, char *dir, int ifd, int ofd, struct lim *lim, struct res *res)
 {
 	int pid, st;
-	int ret = 0;
+	struct rusage ru;
 	struct rlimit rlp;
+	long ms = lim->time + test_boot;/* processor time limit */
+	long cpu;			/* processor time used */
+	char cg[LLEN];			/* the cgroup of the program */
+	int cgmem = 0;			/* memory limited by cg */
+	int cgok = !cg_make(cg, sizeof(cg), lim, &cgmem);
 	if (!(pid = fork())) {
-		chdir(tdir);
+		setpgid(0, 0);
+		if (cgok && cg_write(cg, "cgroup.procs", "0"))
+			exit(1);
+		chdir(dir);
 		nice(1);
 		rlp.rlim_cur = MAXFILE;
 		rlp.rlim_max = MAXFILE;
 		setrlimit(RLIMIT_NOFILE, &rlp);
-		rlp.rlim_cur = MAXFILESIZE;
-		rlp.rlim_max = MAXFILESIZE;
+		rlp.rlim_cur = (ms + 999) / 1000;
+		rlp.rlim_max = rlp.rlim_cur + 1;
+		setrlimit(RLIMIT_CPU, &rlp);
+		rlp.rlim_cur = lim->fsize;
+		rlp.rlim_max = lim->fsize;
 		setrlimit(RLIMIT_FSIZE, &rlp);
-		rlp.rlim_cur = MAXMEM;
-		rlp.rlim_max = MAXMEM;
-		setrlimit(RLIMIT_DATA, &rlp);
-		rlp.rlim_cur = MAXPROC;
-		rlp.rlim_max = MAXPROC;
+		rlp.rlim_cur = lim->mem;
+		rlp.rlim_max = lim->mem;
+		if (!cgmem)
+			setrlimit(RLIMIT_DATA, &rlp);
+		rlp.rlim_cur = lim->proc;
+		rlp.rlim_max = lim->proc;
 		setrlimit(RLIMIT_NPROC, &rlp);
-		if (setgid(TESTUID) || setuid(TESTUID))
+		if (dup2(ifd, 0) < 0 || dup2(ofd, 1) < 0)
 			exit(1);
-		close(0);
-		open(ipath, O_RDONLY);
-		close(1);
-		open(opath, O_WRONLY | O_TRUNC | O_CREAT, 0600);
 		close(2);
-		open(epath, O_WRONLY | O_TRUNC | O_CREAT, 0600);
+		open("/dev/null", O_WRONLY);
+		if (setgid(test_gid) || setuid(test_uid))
+			exit(1);
 		execvp(argv[0], argv);
 		exit(1);
 	}
 	if (pid > 0) {
-		long beg = util_ts();
-		while (util_ts() - beg < TIMEOUT && (ret = waitpid(pid, &st, WNOHANG)) != pid)
-			usleep(WAITDELAY * 1000);
-		if (ret != pid) {
-			util_slaughter();
+		int tle = 0;
+		memset(&ru, 0, sizeof(ru));
+		if (util_wait(pid, &st, &ru, ms * test_wmul) != pid) {
+			tle = 1;
+			if (cgok)
+				cg_write(cg, "cgroup.kill", "1");
+			else if (test_jobs > 1)	/* other test cases are running */
+				kill(-pid, SIGKILL);
+			else
+				util_slaughter();
 			kill(pid, SIGKILL);
-			while (waitpid(pid, &st, 0) != pid)
-				if (util_ts() - beg > TIMEOUT * 2)
-					break;
-			return 'T';
+			util_wait(pid, &st, &ru, lim->time);
 		}
+		cpu = util_cpu(&ru);
+		if (res) {
+			res->kb = ru.ru_maxrss;
+			res->sig = WIFSIGNALED(st) ? WTERMSIG(st) : 0;
+		}
+		if (cgok) {			/* includes all processes */
+			long usec = cg_read(cg, "cpu.stat", "usage_usec");
+			long peak = cg_read(cg, "memory.peak", NULL);
+			if (usec >= 0)
+				cpu = usec / 1000;
+			if (res && peak >= 0)
+				res->kb = peak >> 10;
+		}
+		if (res)
+			res->ms = cpu;
+		if (cgok)
+			cg_free(cg);
+		if (WIFSIGNALED(st) && WTERMSIG(st) == SIGXCPU)
+			tle = 1;
+		if (tle || cpu > ms)	/* the wall-clock timeout is only for sleepers */
+			return 'T';
 		if (WIFSIGNALED(st))
 			return 'R';
 		if (WEXITSTATUS(st))
 			return 'R';
 		return 0;
 	}
+	if (cgok)
+		cg_free(cg);
 	return 'R';
 }
 
-static int compilefile(char *src, char *lang, char *out)
+/* compile src into out; return nonzero if it fails or negative if the compiler cannot run */
+static int compilefile(char *src, char *lang, char *out, long *ms)
 {
 	char **cc = lang ? lang_comp(lang) : NULL;
 	char *args[16];
 	int i;
 	if (cc) {
+		struct rusage ru;
 		int pid = fork();
 		int st;
 		if (pid < 0)
-			return 1;
+			return -1;
 		if (!pid) {
-			if (setgid(TESTUID) || setuid(TESTUID))
+			if (setgid(test_gid) || setuid(test_uid))
 				exit(1);
 			close(1);
 			open("/dev/null", O_WRONLY);
@@ -261,109 +562,547 @@ static int compilefile(char *src, char *lang, char *out)
 			execvp(args[0], args);
 			exit(1);
 		}
-		if (waitpid(pid, &st, 0) != pid)
-			return 1;
-		return WEXITSTATUS(st);
+		if (wait4(pid, &st, 0, &ru) != pid)
+			return -1;
+		*ms = util_cpu(&ru);
+		return WIFEXITED(st) ? WEXITSTATUS(st) : -1;
 	}
 	return util_cp(src, out);
 }
 
-int main(int argc, char *argv[])
+/* the path of prog in the compilation cache; return nonzero if not cachable */
+static int cache_path(char *prog, char *lang, char *path, int len)
+{
+	char buf[1 << 12];
+	char **cc = lang_comp(lang);
+	unsigned long h = 14695981039346656037ul;	/* fnv-1a hash */
+	int fd, nr, i, j;
+	for (i = 0; cc && cc[i]; i++)
+		if (!strcmp("OUT", cc[i]))
+			break;
+	if (!test_cache || !cc || !cc[i])	/* not a single output file */
+		return 1;
+	for (i = -1; i < 0 || cc[i]; i++) {
+		char *s = i < 0 ? lang : cc[i];
+		for (j = 0; j == 0 || s[j - 1]; j++)
+			h = (h ^ (unsigned char) s[j]) * 1099511628211ul;
+	}
+	if ((fd = open(prog, O_RDONLY)) < 0)
+		return 1;
+	while ((nr = read(fd, buf, sizeof(buf))) > 0)
+		for (j = 0; j < nr; j++)
+			h = (h ^ (unsigned char) buf[j]) * 1099511628211ul;
+	close(fd);
+	snprintf(path, len, "%s/%016lx", test_cache, h);
+	return 0;
+}
+
+/*
+ * copy the cached executable of prog to out; return nonzero if missing
+ * or 'E' if prog is known not to compile
+ */
+static int cache_get(char *prog, char *lang, char *out)
+{
+	char path_s[LLEN], path_x[LLEN], path_e[LLEN];
+	int fd1, fd2, miss;
+	if (cache_path(prog, lang, path_s, sizeof(path_s) - 2))
+		return 1;
+	strcpy(path_x, path_s);
+	strcpy(path_e, path_s);
+	strcat(path_s, ".s");
+	strcat(path_x, ".x");
+	strcat(path_e, ".e");
+	fd1 = open(prog, O_RDONLY | O_CLOEXEC);
+	fd2 = open(path_s, O_RDONLY | O_CLOEXEC);
+	miss = util_cmp(fd1, fd2, 'e', 0);
+	if (!miss && util_isfile(path_e))
+		miss = 'E';
+	else if (!miss)
+		miss = util_cp(path_x, out);
+	if (fd1 >= 0)
+		close(fd1);
+	if (fd2 >= 0)
+		close(fd2);
+	if (miss == 1)
+		cache_miss++;
+	else
+		cache_hits++;
+	return miss;
+}
+
+/* store the executable of prog (NULL if it does not compile) in the compilation cache */
+static void cache_put(char *prog, char *lang, char *exec)
+{
+	char path[LLEN], dst[LLEN], tmp[LLEN];
+	int fd;
+	if (cache_path(prog, lang, path, sizeof(path) - 2))
+		return;
+	mkdir(test_cache, 0700);
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+	snprintf(dst, sizeof(dst), "%s.%c", path, exec ? 'x' : 'e');
+	if (exec && !util_cp(exec, tmp))
+		rename(tmp, dst);
+	if (!exec && (fd = open(dst, O_WRONLY | O_CREAT | O_CLOEXEC, 0600)) >= 0)
+		close(fd);
+	snprintf(dst, sizeof(dst), "%s.s", path);
+	if (!util_cp(prog, tmp))
+		rename(tmp, dst);
+	unlink(tmp);
+}
+
+/* read the limits in the given file, if it exists */
+static void lim_read(struct lim *lim, char *path)
+{
+	char line[LLEN], key[LLEN], val[LLEN];
+	FILE *fp = fopen(path, "r");
+	if (!fp)
+		return;
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "%s %s", key, val) != 2)
+			continue;
+		if (!strcmp("time", key) && atol(val) > 0)
+			lim->time = atol(val);
+		if (!strcmp("mem", key) && atol(val) > 0)
+			lim->mem = atol(val) << 20;
+		if (!strcmp("fsize", key) && atol(val) > 0)
+			lim->fsize = atol(val) << 10;
+		if (!strcmp("proc", key) && atol(val) > 0)
+			lim->proc = atol(val);
+		if (!strcmp("cmp", key) && val[0] && strchr("ewtf", val[0]))
+			lim->cmp = val[0];
+		if (!strcmp("eps", key) && atof(val) >= 0)
+			lim->eps = atof(val);
+	}
+	fclose(fp);
+}
+
+/* read the time limit multipliers of languages ("tmul lang n") in the given file */
+static void lang_read(char *path)
+{
+	char line[LLEN], key[LLEN], lang[LLEN];
+	FILE *fp = fopen(path, "r");
+	int i, n;
+	if (!fp)
+		return;
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "%s %s %d", key, lang, &n) != 3)
+			continue;
+		for (i = 0; i < LEN(langs) && !strcmp("tmul", key) && n > 0; i++)
+			if (!strcmp(langs[i].name, lang))
+				langs[i].tmul = n;
+	}
+	fclose(fp);
+}
+
+/* measure the startup time of the interpreter of lang */
+static long ct_boot(char *lang, char *tdir)
+{
+	char **boot = lang_boot(lang);
+	struct res res;
+	int fd;
+	if (!boot || (fd = open("/dev/null", O_RDWR | O_CLOEXEC)) < 0)
+		return 0;
+	if (ct_exec(boot, tdir, fd, fd, &test_lim, &res))
+		res.ms = 0;
+	close(fd);
+	return res.ms;
+}
+
+/* run the i-th test case of cont in directory cdir */
+static void ct_case(char *cont, int i, char **args, char *cdir, struct res *res)
+{
+	struct tcase *tc = &test_cases[i];
+	char idat[LLEN];		/* input file */
+	char vdat[LLEN];		/* verifier program */
+	struct lim plim;		/* program limits */
+	char cdir_i[LLEN], cdir_o[LLEN];/* input and output files in cdir */
+	char cdir_v[LLEN];		/* verifier program in cdir */
+	int ifd, ofd;			/* program input and output */
+	int cmt = 'R';
+	snprintf(idat, sizeof(idat), "%s/%02d", cont, i);
+	snprintf(vdat, sizeof(vdat), "%s/%02dv", cont, i);
+	snprintf(cdir_i, sizeof(cdir_i), "%s/.i", cdir);
+	snprintf(cdir_o, sizeof(cdir_o), "%s/.o", cdir);
+	snprintf(cdir_v, sizeof(cdir_v), "%s/.v", cdir);
+	mkdir(cdir, 0700);
+	chown(cdir, test_uid, test_gid);
+	ifd = tc->ifd >= 0 && lseek(tc->ifd, 0, SEEK_SET) == 0 ? tc->ifd : -1;
+	if (!tc->vrf) {			/* the output is needed only here */
+		ofd = memfd_create(".o", MFD_CLOEXEC);
+	} else {			/* verifiers read .o */
+		ofd = open(cdir_o, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+		if (ofd >= 0)
+			fchown(ofd, test_uid, test_gid);
+	}
+	plim = tc->lim;
+	plim.time = tc->lim.time * test_tmul;
+	memset(res, 0, sizeof(*res));
+	if (ifd >= 0 && ofd >= 0)
+		cmt = ct_exec(args, cdir, ifd, ofd, &plim, res);
+	res->ms = res->ms > test_boot ? res->ms - test_boot : 0;
+	res->score = 0;
+	if (!cmt && !tc->vrf) {		/* expected file */
+		cmt = util_cmpbuf(tc->exp, tc->exp_n, ofd,
+				tc->lim.cmp, tc->lim.eps) ? 'F' : 'P';
+		res->score = cmt == 'P';
+	}
+	if (!cmt && tc->vrf) {		/* verifier program */
+		char *args_check[] = {"./.v", ".i", ".o", NULL};
+		int rfd = memfd_create(".r", MFD_CLOEXEC);
+		FILE *filp;
+		char sdat_i[LLEN], sdat_v[LLEN];	/* copied by ct_load() */
+		snprintf(sdat_i, sizeof(sdat_i), "%s/%02d", test_data, i);
+		snprintf(sdat_v, sizeof(sdat_v), "%s/%02dv", test_data, i);
+		if (link(sdat_i, cdir_i))
+			util_install(idat, cdir_i, test_uid, test_gid, 0600);
+		if (link(sdat_v, cdir_v))
+			util_install(vdat, cdir_v, test_uid, test_gid, 0700);
+		cmt = 'P';
+		if (rfd < 0 || lseek(ofd, 0, SEEK_SET) != 0 ||
+				ct_exec(args_check, cdir, ofd, rfd, &tc->lim, NULL))
+			cmt = 'F';
+		filp = util_fdopen(rfd);
+		if (filp) {
+			if (fscanf(filp, "%d", &res->score) != 1)
+				res->score = 0;
+			fclose(filp);
+		}
+		if (rfd >= 0)
+			close(rfd);
+		unlink(cdir_v);
+		unlink(cdir_i);
+	}
+	res->cmt = cmt;
+	if (ofd >= 0)
+		close(ofd);
+	unlink(cdir_o);
+	rmdir(cdir);
+}
+
+/* run n test cases, test_jobs of them at once */
+static void ct_cases(char *cont, char **args, char *tdir, struct res *res, int n)
+{
+	char cdir[LLEN];
+	int running = 0;
+	int tle = 0;
+	int pid;
+	int i;
+	for (i = 0; i < n; i++) {
+		snprintf(cdir, sizeof(cdir), "%s/%02d", tdir, i);
+		if (running && running >= test_jobs && wait(NULL) > 0)
+			running--;
+		pid = test_jobs > 1 ? fork() : -1;
+		if (!pid) {
+			ct_case(cont, i, args, cdir, &res[i]);
+			exit(0);
+		}
+		if (pid < 0)
+			ct_case(cont, i, args, cdir, &res[i]);
+		else
+			running++;
+	}
+	while (running > 0 && wait(NULL) > 0)
+		running--;
+	for (i = 0; i < n; i++)
+		tle = tle || res[i].cmt == 'T';
+	if (test_jobs > 1 && !test_cgroup && tle)	/* escaped kill(-pid) */
+		util_slaughter();
+}
+
+/* a submission to rejudge */
+struct rj {
+	char user[LLEN];		/* submitting user */
+	long date;			/* submission date */
+	char *line;			/* the previous stat line */
+	char path[LLEN];		/* program path */
+	char lang[LLEN];		/* program language */
+	int pid;			/* testing process */
+	int slot;			/* worker index, for its sandbox user */
+	int ofd;			/* the output of test */
+	char res[LLEN * 2];		/* the new result */
+};
+
+static unsigned long rj_hash(char *user, long date)
+{
+	unsigned long h = 14695981039346656037ul;	/* fnv-1a hash */
+	for (; *user; user++)
+		h = (h ^ (unsigned char) *user) * 1099511628211ul;
+	return (h ^ date) * 1099511628211ul;
+}
+
+/* find the programs of the submissions in LOGS/CONT-DATE-USER.LANG */
+static void rj_index(char *cont, struct rj *rj, int n)
+{
+	int sz = 1, *tab;
+	int contlen = strlen(cont);
+	struct dirent *de;
+	DIR *dir;
+	int i;
+	while (sz < n * 2)
+		sz <<= 1;
+	if (!(tab = malloc(sz * sizeof(tab[0]))) || !(dir = opendir(LOGS))) {
+		free(tab);
+		return;
+	}
+	for (i = 0; i < sz; i++)
+		tab[i] = -1;
+	for (i = 0; i < n; i++) {	/* open addressing with linear probing */
+		int h = rj_hash(rj[i].user, rj[i].date) & (sz - 1);
+		while (tab[h] >= 0)
+			h = (h + 1) & (sz - 1);
+		tab[h] = i;
+	}
+	while ((de = readdir(dir))) {
+		char user[LLEN], *ext;
+		long date;
+		int h;
+		if (strncmp(de->d_name, cont, contlen) || de->d_name[contlen] != '-')
+			continue;
+		if (sscanf(de->d_name + contlen, "-%ld-%255s", &date, user) != 2)
+			continue;
+		if (!(ext = strrchr(user, '.')))
+			continue;
+		*ext++ = '\0';
+		h = rj_hash(user, date) & (sz - 1);
+		for (; tab[h] >= 0; h = (h + 1) & (sz - 1)) {
+			struct rj *r = &rj[tab[h]];
+			if (r->date == date && !strcmp(r->user, user) && !r->path[0]) {
+				snprintf(r->path, sizeof(r->path), "%s/%s", LOGS, de->d_name);
+				snprintf(r->lang, sizeof(r->lang), "%s", ext);
+			}
+		}
+	}
+	closedir(dir);
+	free(tab);
+}
+
+/* collect the output of a finished rejudge process */
+static int rj_wait(struct rj *rj, int n, int *done)
+{
+	FILE *fp;
+	int pid = wait(NULL);
+	int i;
+	for (i = 0; i < n && rj[i].pid != pid; i++)
+		;
+	if (pid <= 0 || i == n)
+		return -1;
+	rj[i].pid = 0;
+	if ((fp = util_fdopen(rj[i].ofd))) {
+		if (!fgets(rj[i].res, sizeof(rj[i].res), fp))
+			rj[i].res[0] = '\0';
+		fclose(fp);
+	}
+	close(rj[i].ofd);
+	fprintf(stderr, "rejudge: %d/%d\t%s\t%ld\t%s", ++*done, n,
+		rj[i].user, rj[i].date, rj[i].res[0] ? rj[i].res : "failed\n");
+	return i;
+}
+
+/* test the submissions of cont listed in stdin again, test_jobs at once */
+static int ct_rejudge(char *self, char *cont, char *out)
+{
+	struct rj *rj = NULL;
+	char line[LLEN * 4];
+	char uid[32], cmp[2] = {test_lim.cmp}, eps[64], tmp[LLEN];
+	char *busy = calloc(test_jobs, 1);	/* busy workers */
+	int n = 0, sz = 0, running = 0, done = 0;
+	int i, j;
+	FILE *fp = stdout;
+	while (fgets(line, sizeof(line), stdin)) {
+		if (n == sz) {
+			sz = sz ? sz * 2 : 256;
+			rj = realloc(rj, sz * sizeof(rj[0]));
+		}
+		memset(&rj[n], 0, sizeof(rj[n]));
+		if (sscanf(line, "%255s %ld", rj[n].user, &rj[n].date) == 2) {
+			rj[n].line = strdup(line);
+			n++;
+		}
+	}
+	rj_index(cont, rj, n);
+	snprintf(eps, sizeof(eps), "%.17g", test_lim.eps);
+	for (i = 0; i < n; i++) {
+		char *argv[16] = {self, "-u", uid, "-m", cmp, "-e", eps};
+		int argc = 7;
+		if (!rj[i].path[0]) {
+			fprintf(stderr, "rejudge: %d/%d\t%s\t%ld\tno program\n",
+				++done, n, rj[i].user, rj[i].date);
+			continue;
+		}
+		while (running >= test_jobs && (j = rj_wait(rj, n, &done)) >= 0) {
+			busy[rj[j].slot] = 0;
+			running--;
+		}
+		for (rj[i].slot = 0; busy[rj[i].slot]; rj[i].slot++)
+			;
+		busy[rj[i].slot] = 1;
+		snprintf(uid, sizeof(uid), "%d", test_uid + rj[i].slot);
+		if (test_cache) {
+			argv[argc++] = "-c";
+			argv[argc++] = test_cache;
+		}
+		if (test_cgroup) {
+			argv[argc++] = "-g";
+			argv[argc++] = test_cgroup;
+		}
+		argv[argc++] = cont;
+		argv[argc++] = rj[i].path;
+		argv[argc++] = rj[i].lang;
+		rj[i].ofd = memfd_create(".r", MFD_CLOEXEC);
+		if (rj[i].ofd < 0 || (rj[i].pid = fork()) < 0) {
+			fprintf(stderr, "rejudge: %d/%d\t%s\t%ld\tfailed\n",
+				++done, n, rj[i].user, rj[i].date);
+			if (rj[i].ofd >= 0)
+				close(rj[i].ofd);
+			rj[i].pid = 0;
+			busy[rj[i].slot] = 0;
+			continue;
+		}
+		if (!rj[i].pid) {
+			dup2(rj[i].ofd, 1);
+			execv(self, argv);
+			exit(1);
+		}
+		running++;
+	}
+	while (running > 0 && rj_wait(rj, n, &done) >= 0)
+		running--;
+	snprintf(tmp, sizeof(tmp), "%s.tmp", out ? out : "");
+	if (out && !(fp = fopen(tmp, "w"))) {
+		fprintf(stderr, "rejudge: cannot write <%s>\n", tmp);
+		return 1;
+	}
+	for (i = 0; i < n; i++) {	/* keep the old result if failed */
+		if (rj[i].res[0])
+			fprintf(fp, "%s\t%ld\t%s", rj[i].user, rj[i].date, rj[i].res);
+		else
+			fputs(rj[i].line, fp);
+	}
+	if (out && (fclose(fp) || rename(tmp, out))) {
+		fprintf(stderr, "rejudge: cannot write <%s>\n", out);
+		return 1;
+	}
+	return 0;
+}
+
+/* read the limits of cont and load its test cases */
+static void ct_load(char *cont)
 {
-	char *cont, *prog, *lang;
 	char idat[LLEN], odat[LLEN];	/* input and output files */
 	char vdat[LLEN];		/* verifier program */
-	char tdir[LLEN];		/* testing directory */
-	char tdir_i[LLEN], tdir_o[LLEN];/* input and output files in tdir */
+	char ldat[LLEN];		/* test case limits */
+	char sdat[LLEN];		/* copies in test_data */
+	snprintf(ldat, sizeof(ldat), "%s/%s", cont, LIMITS);
+	lim_read(&test_lim, ldat);
+	lang_read(ldat);
+	for (test_n = 0; test_n < LEN(test_cases); test_n++) {
+		struct tcase *tc = &test_cases[test_n];
+		int efd;
+		snprintf(idat, sizeof(idat), "%s/%02d", cont, test_n);
+		snprintf(odat, sizeof(odat), "%s/%02do", cont, test_n);
+		snprintf(vdat, sizeof(vdat), "%s/%02dv", cont, test_n);
+		snprintf(ldat, sizeof(ldat), "%s/%02dl", cont, test_n);
+		if (!util_isfile(idat) || (!util_isfile(odat) &&
+						!util_isfile(vdat)))
+			break;
+		tc->ifd = open(idat, O_RDONLY | O_CLOEXEC);
+		tc->vrf = !util_isfile(odat);
+		if (tc->vrf && !test_data[0]) {
+			snprintf(test_data, sizeof(test_data), "/tmp/ct%06d.d", getpid());
+			mkdir(test_data, 0700);
+		}
+		if (tc->vrf) {		/* read-only copies; linked by ct_case() */
+			snprintf(sdat, sizeof(sdat), "%s/%02d", test_data, test_n);
+			util_install(idat, sdat, 0, 0, 0644);
+			snprintf(sdat, sizeof(sdat), "%s/%02dv", test_data, test_n);
+			util_install(vdat, sdat, 0, 0, 0755);
+		}
+		if (!tc->vrf) {
+			efd = open(odat, O_RDONLY | O_CLOEXEC);
+			tc->exp = util_map(efd, &tc->exp_n);
+			if (efd >= 0)
+				close(efd);
+		}
+		tc->lim = test_lim;
+		lim_read(&tc->lim, ldat);
+	}
+}
+
+/* remove the copies made by ct_load() */
+static void ct_unload(void)
+{
+	char path[LLEN];
+	int i;
+	for (i = 0; i < test_n && test_data[0]; i++) {
+		snprintf(path, sizeof(path), "%s/%02d", test_data, i);
+		unlink(path);
+		snprintf(path, sizeof(path), "%s/%02dv", test_data, i);
+		unlink(path);
+	}
+	if (test_data[0])
+		rmdir(test_data);
+}
+
+/* judge prog in tdir and print its results; res is shared with test case processes */
+static void ct_test(char *cont, char *prog, char *lang, char *tdir, struct res *res)
+{
 	char tdir_s[LLEN];		/* source file in tdir */
 	char tdir_x[LLEN];		/* compiled source in tdir */
-	char tdir_v[LLEN];		/* verifier program in tdir */
-	char tdir_r[LLEN];		/* varifier output in tdir */
 	int score = 0;			/* total score */
 	char stat[128] = "";
 	char *args[16];
-	long beg_ms, end_ms, tot_ms = 0;
+	long tot_ms = 0;
+	long cc_ms = 0;			/* compilation time */
 	int passed = 1;
 	int cmt = 0;
+	int cached = 1;			/* cache_get() result */
+	int n = test_n;
 	int i;
-	if (argc != 4) {
-		fprintf(stderr, "usage: %s cont prog lang\n", argv[0]);
-		return 1;
-	}
-	cont = argv[1];
-	prog = argv[2];
-	lang = argv[3];
-	if (!util_isdir(cont)) {
-		fprintf(stderr, "nonexistent contest <%s>\n", cont);
-		return 1;
-	}
-	if (!util_isfile(prog)) {
-		fprintf(stderr, "nonexistent program <%s>\n", prog);
-		return 1;
-	}
-	snprintf(tdir, sizeof(tdir), "/tmp/ct%06d", getpid());
-	snprintf(tdir_i, sizeof(tdir_i), "%s/.i", tdir);
-	snprintf(tdir_o, sizeof(tdir_o), "%s/.o", tdir);
+	test_tmul = lang_tmul(lang);
+	test_boot = 0;
 	snprintf(tdir_s, sizeof(tdir_s), "%s/%s", tdir, lang_file(lang));
 	snprintf(tdir_x, sizeof(tdir_x), "%s/%s", tdir, lang_exec(lang));
-	snprintf(tdir_v, sizeof(tdir_v), "%s/.v", tdir);
-	snprintf(tdir_r, sizeof(tdir_r), "%s/.r", tdir);
 	mkdir(tdir, 0700);
-	chown(tdir, TESTUID, TESTGID);
-	util_install(prog, tdir_s, TESTUID, TESTGID, 0600);
-	if (compilefile(tdir_s, lang, tdir_x))
+	chown(tdir, test_uid, test_gid);
+	if (util_install(prog, tdir_s, test_uid, test_gid, 0600))
+		cmt = 'E';
+	if (!cmt && (cached = cache_get(prog, lang, tdir_x)) == 'E')
 		cmt = 'E';
+	if (!cmt && cached) {
+		int cc = compilefile(tdir_s, lang, tdir_x, &cc_ms);
+		if (cc)
+			cmt = 'E';
+		if (cc >= 0)		/* not failures of the judge */
+			cache_put(prog, lang, cc ? NULL : tdir_x);
+	}
 	unlink(tdir_s);
 	if (lang_intr(lang)) {
 		char **intr = lang_intr(lang);
-		for (i = 0; i < LEN(args) && intr[i]; i++)
-			args[i] = !strcmp("SRC", intr[i]) ? tdir_x : intr[i];
+		for (i = 0; i + 1 < LEN(args) && intr[i]; i++) {
+			args[i] = intr[i];
+			if (!strcmp("SRC", intr[i]))
+				args[i] = tdir_x;
+			if (!strcmp("DIR", intr[i]))
+				args[i] = tdir;
+		}
+		args[i] = NULL;
 	} else {
 		args[0] = tdir_x;
 		args[1] = NULL;
 	}
-	chown(tdir_x, TESTUID, TESTGID);
+	chown(tdir_x, test_uid, test_gid);
 	chmod(tdir_x, 0700);
-	for (i = 0; i < 100; i++) {
-		snprintf(idat, sizeof(idat), "%s/%02d", cont, i);
-		snprintf(odat, sizeof(odat), "%s/%02do", cont, i);
-		snprintf(vdat, sizeof(vdat), "%s/%02dv", cont, i);
-		if (!util_isfile(idat) || (!util_isfile(odat) &&
-						!util_isfile(vdat)))
-			break;
-		util_install(idat, tdir_i, TESTUID, TESTGID, 0600);
-		beg_ms = util_ts();
-		if (cmt != 'E')
-			cmt = ct_exec(args, tdir, ".i", ".o", "/dev/null");
-		end_ms = util_ts();
-		tot_ms += end_ms - beg_ms;
-		if (!cmt && util_isfile(odat)) {	/* expected file */
-			cmt = 'F';
-			if (util_isfile(tdir_o) && !util_cmp(odat, tdir_o))
-				cmt = 'P';
-			score += cmt == 'P';
-		}
-		if (!cmt && !util_isfile(odat)) {	/* verifier program */
-			char *args_check[] = {"./.v", ".i", ".o", NULL};
-			FILE *filp;
-			util_install(idat, tdir_i, TESTUID, TESTGID, 0600);
-			util_install(vdat, tdir_v, TESTUID, TESTGID, 0700);
-			cmt = 'P';
-			if (ct_exec(args_check, tdir, ".o", ".r", "/dev/null"))
-				cmt = 'F';
-			filp = fopen(tdir_r, "r");
-			if (filp) {
-				int score_cur;
-				if (fscanf(filp, "%d", &score_cur) == 1)
-					score += score_cur;
-				fclose(filp);
-			}
-			unlink(tdir_v);
-			unlink(tdir_r);
-		}
-		stat[i] = cmt;
-		unlink(tdir_i);
-		unlink(tdir_o);
+	memset(res, 0, sizeof(res[0]) * n);
+	for (i = 0; i < n; i++)
+		res[i].cmt = 'E';
+	if (cmt != 'E' && n > 0)
+		test_boot = ct_boot(lang, tdir);
+	if (cmt != 'E')
+		ct_cases(cont, args, tdir, res, n);
+	for (i = 0; i < n; i++) {
+		stat[i] = res[i].cmt;
+		score += res[i].score;
+		tot_ms += res[i].ms;
 	}
 	for (i = 0; stat[i] && passed; i++)
 		passed = stat[i] == 'P';
@@ -373,5 +1112,99 @@ int main(int argc, char *argv[])
 		score, (int) strlen(stat),
 		tot_ms / 1000, (tot_ms % 1000) / 10,
 		stat, passed ? '.' : '!');
+	if (test_ext) {
+		printf("%ld", cc_ms);
+		for (i = 0; i < n; i++)
+			printf("\t%c/%ld/%ld/%d", res[i].cmt,
+				res[i].ms, res[i].kb, res[i].sig);
+		printf("\n");
+	}
+	fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+	char *cont, *prog, *lang;
+	char tdir[LLEN];		/* testing directory */
+	char line[LLEN * 2], bprog[LLEN], blang[LLEN];
+	struct res *res;		/* test case results */
+	int rejudge = 0;		/* rejudge submissions in stdin */
+	char *rejudge_out = NULL;	/* rejudge output file */
+	int batch = 0;			/* judge the programs in stdin */
+	int jobs = 0;
+	long ncpu;
+	int cmpok;			/* valid -m */
+	int i;
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (argv[i][1] == 'u') {
+			test_uid = atoi(argv[i][2] ? argv[i] + 2 : argv[++i]);
+			test_gid = test_uid;
+		}
+		if (argv[i][1] == 'j')
+			test_jobs = atoi(argv[i][2] ? argv[i] + 2 : argv[++i]);
+		if (argv[i][1] == 'c')
+			test_cache = argv[i][2] ? argv[i] + 2 : argv[++i];
+		if (argv[i][1] == 'm')
+			test_lim.cmp = (argv[i][2] ? argv[i] + 2 : argv[++i])[0];
+		if (argv[i][1] == 'e')
+			test_lim.eps = atof(argv[i][2] ? argv[i] + 2 : argv[++i]);
+		if (argv[i][1] == 'x')
+			test_ext = 1;
+		if (argv[i][1] == 'g')
+			test_cgroup = argv[i][2] ? argv[i] + 2 : argv[++i];
+		if (argv[i][1] == 'R')
+			rejudge = 1;
+		if (argv[i][1] == 'o')
+			rejudge_out = argv[i][2] ? argv[i] + 2 : argv[++i];
+		if (argv[i][1] == 'B')
+			batch = 1;
+	}
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpu > 0 && test_jobs > ncpu)	/* test cases wait for processors */
+		test_wmul = WALLMUL * ((test_jobs + ncpu - 1) / ncpu);
+	cmpok = test_lim.cmp && strchr("ewtf", test_lim.cmp);
+	if (rejudge && argc - i == 1 && test_jobs > 0 && cmpok)
+		return ct_rejudge("/proc/self/exe", argv[i], rejudge_out);
+	if (argc - i != (batch ? 1 : 3) || test_jobs < 1 || !cmpok) {
+		fprintf(stderr, "usage: %s [-u uid] [-j jobs] [-c cache] "
+			"[-m e|w|t|f] [-e eps] [-x] [-g cgroup] cont prog lang\n", argv[0]);
+		fprintf(stderr, "       %s -B [options] cont <jobs\n", argv[0]);
+		fprintf(stderr, "       %s -R [-o out] [options] cont <cont.stat\n", argv[0]);
+		return 1;
+	}
+	cont = argv[i];
+	prog = batch ? NULL : argv[i + 1];
+	lang = batch ? NULL : argv[i + 2];
+	if (!util_isdir(cont)) {
+		fprintf(stderr, "nonexistent contest <%s>\n", cont);
+		return 1;
+	}
+	if (prog && !util_isfile(prog)) {
+		fprintf(stderr, "nonexistent program <%s>\n", prog);
+		return 1;
+	}
+	ct_load(cont);
+	if (test_cgroup)
+		cg_write(test_cgroup, "cgroup.subtree_control", "+cpu +memory +pids");
+	res = mmap(NULL, sizeof(res[0]) * LEN(test_cases), PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (res == MAP_FAILED) {
+		ct_unload();
+		return 1;
+	}
+	if (!batch) {
+		snprintf(tdir, sizeof(tdir), "/tmp/ct%06d", getpid());
+		ct_test(cont, prog, lang, tdir, res);
+	}
+	while (batch && fgets(line, sizeof(line), stdin)) {
+		if (sscanf(line, "%255s %255s", bprog, blang) != 2)
+			continue;
+		snprintf(tdir, sizeof(tdir), "/tmp/ct%06d.%d", getpid(), jobs++);
+		ct_test(cont, bprog, blang, tdir, res);
+	}
+	ct_unload();
+	if (test_cache && batch)
+		fprintf(stderr, "compilation cache: %d hits, %d misses\n",
+			cache_hits, cache_miss);
 	return 0;
 }
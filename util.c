@@ -0,0 +1,88 @@
+/* Challenging Thursdays Server and Node Utilities */
+#include <fcntl.h>
+#include <netdb.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "util.h"
+
+#define CTTEST		"./test"	/* verification program */
+#define CTCACHE		"logs/cache"	/* compilation cache directory */
+
+/* return a server socket listening on the given port */
+int util_mksocket(char *addr, char *port)
+{
+	struct addrinfo hints, *addrinfo;
+	int fd;
+	int yes = 1;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = addr ? 0 : AI_PASSIVE;
+	if (getaddrinfo(addr, port, &hints, &addrinfo))
+		return -1;
+	fd = socket(addrinfo->ai_family, addrinfo->ai_socktype,
+			addrinfo->ai_protocol);
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+	fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	if (bind(fd, addrinfo->ai_addr, addrinfo->ai_addrlen) < 0)
+		return -1;
+	if (listen(fd, SOMAXCONN))
+		return -1;
+	freeaddrinfo(addrinfo);
+	return fd;
+}
+
+int util_isdir(char *path)
+{
+	struct stat st;
+	if (stat(path, &st) < 0)
+		return 0;
+	return S_ISDIR(st.st_mode);
+}
+
+/* run test -x for a program as uid, writing its output to res; return its pid */
+int util_judge(int uid, char *cgroup, char *cont, char *path, char *lang, char *res)
+{
+	int pid = fork();
+	if (!pid) {
+		char uids[32];
+		char *argv[16] = {CTTEST, "-x", "-u", uids, "-c", CTCACHE};
+		int argc = 6;
+		sigset_t mask;
+		sigemptyset(&mask);
+		sigprocmask(SIG_SETMASK, &mask, NULL);
+		signal(SIGPIPE, SIG_DFL);	/* ignored dispositions survive exec */
+		snprintf(uids, sizeof(uids), "%d", uid);
+		if (cgroup) {
+			argv[argc++] = "-g";
+			argv[argc++] = cgroup;
+		}
+		argv[argc++] = cont;
+		argv[argc++] = path;
+		argv[argc++] = lang;
+		close(1);
+		open(res, O_WRONLY | O_TRUNC | O_CREAT, 0600);
+		execvp(argv[0], argv);
+		exit(1);
+	}
+	return pid;
+}
+
+/* return the pid of a terminated child or 0; sfd is the SIGCHLD signalfd */
+int util_reap(int sfd)
+{
+	struct signalfd_siginfo si;
+	int pid;
+	while (read(sfd, &si, sizeof(si)) > 0)
+		;
+	pid = waitpid(-1, NULL, WNOHANG);
+	return pid > 0 ? pid : 0;
+}
@@ -0,0 +1,4 @@
+int util_mksocket(char *addr, char *port);
+int util_isdir(char *path);
+int util_judge(int uid, char *cgroup, char *cont, char *path, char *lang, char *res);
+int util_reap(int sfd);